@@ -107,11 +107,10 @@ public:
 
     void write_frequency()
     {
+        std::ofstream out("output.txt", std::ios::app);
         for (const auto &pair : word_frequency)
         {
-            std::ofstream out("output.txt", std::ios::app);
             out << pair.first << ", " << pair.second << "\n";
-            // std::cout << pair.first << ", " << pair.second << std::endl;
         }
     }
 
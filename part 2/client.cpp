@@ -11,6 +11,8 @@
 #include "json.hpp"
 #include <pthread.h>
 #include <vector>
+#include <algorithm>
+#include "../part 4/coro_runtime.hpp"
 
 using json = nlohmann::json;
 
@@ -20,7 +22,6 @@ private:
     struct sockaddr_in serv_addr;
     std::vector<std::map<std::string, int>> word_frequencies;
     json config;
-    pthread_mutex_t word_frequencies_mutex; // Changed from std::mutex to pthread_mutex_t
     std::vector<double> client_times;
 
 public:
@@ -31,92 +32,73 @@ public:
         int num_clients = config["num_clients"].get<int>();
         word_frequencies.resize(num_clients);
         client_times.resize(num_clients);
-        pthread_mutex_init(&word_frequencies_mutex, NULL); // Initialize pthread mutex
-    }
-
-    ~Client()
-    {
-        pthread_mutex_destroy(&word_frequencies_mutex); // Destroy the mutex in destructor
-    }
-
-    bool connect_to_server(int &sock)
-    {
-        if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
-        {
-            std::cerr << "Socket creation error" << std::endl;
-            return false;
-        }
 
         serv_addr.sin_family = AF_INET;
         serv_addr.sin_port = htons(config["server_port"]);
-
         if (inet_pton(AF_INET, config["server_ip"].get<std::string>().c_str(), &serv_addr.sin_addr) <= 0)
         {
             std::cerr << "Invalid address/ Address not supported" << std::endl;
-            return false;
         }
+    }
 
-        if (connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
+    // Non-blocking, so the connection can be driven by a coroutine
+    Task<bool> connect_to_server(EventLoop &loop, int &sock)
+    {
+        if ((sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0)
+        {
+            std::cerr << "Socket creation error" << std::endl;
+            co_return false;
+        }
+
+        bool connected = co_await async_connect(loop, sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr));
+        if (!connected)
         {
             std::cerr << "Connection Failed" << std::endl;
-            return false;
+            close(sock);
+            co_return false;
         }
 
-        return true;
+        co_return true;
     }
 
-    void process_words(int sock, int client_id)
+    // Only this client's coroutine touches word_frequencies[client_id], so
+    // no lock is needed
+    Task<void> process_words(EventLoop &loop, int sock, int client_id)
     {
         int offset = 0;
-        std::string message;
-        char buffer[1024] = {0};
         int req_words = config["k"].get<int>();
         int words_received = 0;
+        LineReader reader(loop, sock);
+        std::string line;
 
-        while (true)
+        std::string message = std::to_string(offset) + "\n";
+        bool sent = co_await async_send(loop, sock, message.c_str(), message.length());
+        while (sent)
         {
-            if (offset == 0)
-            {
-                message = std::to_string(offset) + "\n";
-                send(sock, message.c_str(), message.length(), 0);
-            }
-            if (words_received >= req_words)
+            bool received = co_await reader.read_line(line);
+            if (!received || line == "$$")
             {
-                message = std::to_string(offset) + "\n";
-                send(sock, message.c_str(), message.length(), 0);
-                words_received = 0;
+                co_return;
             }
-            memset(buffer, 0, sizeof(buffer));
-            int valread = read(sock, buffer, 1024);
 
-            if (strcmp(buffer, "$$\n") == 0 || valread <= 0)
+            std::istringstream line_stream(line);
+            std::string word;
+            while (std::getline(line_stream, word, ','))
             {
-                break;
+                if (word == "EOF")
+                {
+                    co_return;
+                }
+                words_received++;
+                word_frequencies[client_id][word]++;
+                offset++;
             }
 
-            std::istringstream iss(buffer);
-            std::string line;
-            while (std::getline(iss, line))
+            if (words_received >= req_words)
             {
-                std::istringstream line_stream(line);
-                std::string word;
-                while (std::getline(line_stream, word, ','))
-                {
-                    if (word == "EOF")
-                    {
-                        return;
-                    }
-                    words_received++;
-
-                    // Lock the mutex before updating the shared word frequencies
-                    pthread_mutex_lock(&word_frequencies_mutex);
-
-                    word_frequencies[client_id][word]++;
-                    offset++;
-
-                    // Unlock the mutex after updating shared data
-                    pthread_mutex_unlock(&word_frequencies_mutex);
-                }
+                message = std::to_string(offset) + "\n";
+                sent = co_await async_send(loop, sock, message.c_str(), message.length());
+                words_received = 0;
             }
         }
     }
@@ -136,17 +118,18 @@ public:
         std::cout << "Client " << client_id << " output written to " << filename << std::endl;
     }
 
-    void run_client(int client_id)
+    Task<void> run_client(EventLoop &loop, int client_id)
     {
         auto start = std::chrono::high_resolution_clock::now();
 
         int sock = 0;
-        if (!connect_to_server(sock))
+        bool connected = co_await connect_to_server(loop, sock);
+        if (!connected)
         {
-            return;
+            co_return;
         }
 
-        process_words(sock, client_id);
+        co_await process_words(loop, sock, client_id);
         close(sock);
 
         write_frequency(client_id);
@@ -158,24 +141,33 @@ public:
         std::cout << "Client " << client_id << " completed in " << diff.count() << " seconds" << std::endl;
     }
 
+    // Runs clients first, first + stride, ... as coroutines on one loop
     static void *run_client_thread(void *arg)
     {
         ThreadArgs *args = static_cast<ThreadArgs *>(arg);
-        args->client->run_client(args->client_id);
+        EventLoop loop;
+        for (int id = args->first; id < (int)args->client->client_times.size(); id += args->stride)
+        {
+            loop.spawn(args->client->run_client(loop, id));
+        }
+        loop.run();
         delete args;
         return NULL;
     }
 
+    // Clients are coroutines, so "client_threads" threads can drive any
+    // number of them; the default is still a thread per client
     void run()
     {
         auto start = std::chrono::high_resolution_clock::now();
 
         int num_clients = config["num_clients"].get<int>();
-        std::vector<pthread_t> client_threads(num_clients);
+        int num_threads = std::max(1, std::min(config.value("client_threads", num_clients), num_clients));
+        std::vector<pthread_t> client_threads(num_threads);
 
-        for (int i = 0; i < num_clients; ++i)
+        for (int i = 0; i < num_threads; ++i)
         {
-            ThreadArgs *args = new ThreadArgs{this, i};
+            ThreadArgs *args = new ThreadArgs{this, i, num_threads};
             int rc = pthread_create(&client_threads[i], NULL, run_client_thread, args);
             if (rc)
             {
@@ -184,7 +176,7 @@ public:
             }
         }
 
-        for (int i = 0; i < num_clients; ++i)
+        for (int i = 0; i < num_threads; ++i)
         {
             pthread_join(client_threads[i], NULL);
         }
@@ -209,7 +201,8 @@ private:
     struct ThreadArgs
     {
         Client *client;
-        int client_id;
+        int first;
+        int stride;
     };
 };
 
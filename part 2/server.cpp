@@ -13,6 +13,10 @@
 // #include <thread>
 #include <pthread.h>
 #include <mutex>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <deque>
 
 using json = nlohmann::json;
 
@@ -28,12 +32,25 @@ private:
     // std::mutex words_mutex;
     pthread_mutex_t words_mutex;
 
+    // A window rendered once and shared by every connection sending it
+    struct RenderedWindow
+    {
+        std::string data;
+        std::vector<size_t> packet_ends;
+    };
+    std::map<int, std::weak_ptr<const RenderedWindow>> windows_in_flight; // keyed by offset, guarded by words_mutex
+    std::deque<std::shared_ptr<const RenderedWindow>> recent_windows;     // keeps windows alive for stragglers
+    size_t recent_window_limit;
+    std::atomic<unsigned long> coalesce_hits{0};
+    std::atomic<unsigned long> coalesce_misses{0};
+
 public:
     Server(const std::string &config_file)
     {
         std::ifstream f(config_file);
         config = json::parse(f);
         load_words();
+        recent_window_limit = config.value("coalesce_cache", 64);
         pthread_mutex_init(&words_mutex, NULL);
     }
 
@@ -109,60 +126,126 @@ public:
         return NULL;
     }
 
+    std::shared_ptr<const RenderedWindow> render_window(int offset)
+    {
+        auto window = std::make_shared<RenderedWindow>();
+        int k = config["k"].get<int>();
+        int p = config["p"].get<int>();
+        int words_sent = 0;
+        bool eofAdded = false;
+        std::string response;
+
+        for (int i = 0; i < k && offset + i < (int)words.size(); i++)
+        {
+            response += words[offset + i] + ",";
+            words_sent++;
+
+            if (words_sent == p || i == k - 1 || offset + i == (int)words.size() - 1)
+            {
+                if (offset + i == (int)words.size() - 1 && !eofAdded)
+                {
+                    response += "EOF\n";
+                    eofAdded = true;
+                }
+                response.pop_back(); // Remove the last comma
+                response += "\n";
+                window->data += response;
+                window->packet_ends.push_back(window->data.size());
+                response.clear();
+                words_sent = 0;
+            }
+        }
+
+        if (!eofAdded && offset + k >= (int)words.size())
+        {
+            window->data += "EOF\n";
+            window->packet_ends.push_back(window->data.size());
+        }
+        return window;
+    }
+
+    // Clients started together ask for the same offsets in near lockstep.
+    // Whoever asks first renders the window; everyone asking while a
+    // connection still holds it, or while it is among the last
+    // "coalesce_cache" rendered windows, shares the same buffer.
+    std::shared_ptr<const RenderedWindow> coalesce_window(int offset)
+    {
+        pthread_mutex_lock(&words_mutex);
+        std::shared_ptr<const RenderedWindow> window;
+        auto it = windows_in_flight.find(offset);
+        if (it != windows_in_flight.end())
+        {
+            window = it->second.lock();
+        }
+
+        if (window)
+        {
+            coalesce_hits++;
+        }
+        else
+        {
+            coalesce_misses++;
+            window = render_window(offset);
+            windows_in_flight[offset] = window;
+            recent_windows.push_back(window);
+            if (recent_windows.size() > recent_window_limit)
+            {
+                recent_windows.pop_front();
+            }
+            if (windows_in_flight.size() > 1024)
+            {
+                for (auto entry = windows_in_flight.begin(); entry != windows_in_flight.end();)
+                {
+                    entry = entry->second.expired() ? windows_in_flight.erase(entry) : std::next(entry);
+                }
+            }
+        }
+        pthread_mutex_unlock(&words_mutex);
+        return window;
+    }
+
+    std::string stats_line()
+    {
+        unsigned long hits = coalesce_hits.load();
+        unsigned long misses = coalesce_misses.load();
+        double hit_rate = hits + misses > 0 ? (double)hits / (hits + misses) : 0.0;
+        return "coalesce_hits=" + std::to_string(hits) + " coalesce_misses=" + std::to_string(misses) +
+               " coalesce_hit_rate=" + std::to_string(hit_rate) + "\n";
+    }
+
     void handle_client(int client_socket)
     {
         char buffer[1024] = {0};
         while (true)
         {
-            int valread = read(client_socket, buffer, 1024);
+            int valread = read(client_socket, buffer, 1023);
             if (valread <= 0)
             {
                 break;
             }
+            buffer[valread] = '\0';
+
+            if (strncmp(buffer, "STATS", 5) == 0)
+            {
+                std::string stats = stats_line();
+                send(client_socket, stats.c_str(), stats.length(), 0);
+                continue;
+            }
 
             int offset = std::stoi(buffer);
 
-            // std::unique_lock<std::mutex> lock(words_mutex);
-            pthread_mutex_lock(&words_mutex);
             if (offset >= (int)words.size())
             {
                 send(client_socket, "$$\n", 3, 0);
-                pthread_mutex_unlock(&words_mutex);
                 break;
             }
 
-            std::string response;
-            int k = config["k"].get<int>();
-            int p = config["p"].get<int>();
-            int words_sent = 0;
-            bool eofAdded = false;
-
-            for (int i = 0; i < k && offset + i < (int)words.size(); i++)
-            {
-                response += words[offset + i] + ",";
-                words_sent++;
-
-                if (words_sent == p || i == k - 1 || offset + i == (int)words.size() - 1)
-                {
-                    if (offset + i == (int)words.size() - 1 && !eofAdded)
-                    {
-                        response += "EOF\n";
-                        eofAdded = true;
-                    }
-                    response.pop_back(); // Remove the last comma
-                    response += "\n";
-                    send(client_socket, response.c_str(), response.length(), 0);
-                    response.clear();
-                    words_sent = 0;
-                }
-            }
-            // lock.unlock();
-            pthread_mutex_unlock(&words_mutex);
-
-            if (!eofAdded && offset + k >= (int)words.size())
+            std::shared_ptr<const RenderedWindow> window = coalesce_window(offset);
+            size_t packet_start = 0;
+            for (size_t packet_end : window->packet_ends)
             {
-                response = "EOF\n";
-                send(client_socket, response.c_str(), response.length(), 0);
+                send(client_socket, window->data.data() + packet_start, packet_end - packet_start, 0);
+                packet_start = packet_end;
             }
         }
         close(client_socket);
@@ -12,6 +12,7 @@
 #include <atomic>
 #include <fstream>
 #include <signal.h>
+#include "../part 4/trace.hpp"
 
 #define PORT 8080
 #define SERVER_IP "127.0.0.1"
@@ -48,6 +49,7 @@ void *binary_exponential_backoff(void *arg)
 {
     int client_id = *(int *)arg;
     delete (int *)arg;
+    TRACE_THREAD_NAME("beb");
 
     std::unordered_map<std::string, int> word_count;
     const int max_backoff_attempts = 10; // Set a limit for backoff attempts
@@ -73,7 +75,12 @@ void *binary_exponential_backoff(void *arg)
             continue;
         }
 
-        if (connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
+        int connected;
+        {
+            TRACE_SCOPE_ARG("connect", client_id);
+            connected = connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr));
+        }
+        if (connected < 0)
         {
             std::cerr << "Client " << client_id << ": Connection Failed\n";
             close(sock);
@@ -94,7 +101,11 @@ void *binary_exponential_backoff(void *arg)
         int backoff_attempts_beb = 0; // Reset backoff attempts for each new connection
         while (true)
         {
-            int valread = read(sock, buffer, BUFFER_SIZE);
+            int valread;
+            {
+                TRACE_SCOPE_ARG("receive", client_id);
+                valread = read(sock, buffer, BUFFER_SIZE);
+            }
             if (valread <= 0)
                 break;
             std::string data(buffer, valread);
@@ -113,6 +124,7 @@ void *binary_exponential_backoff(void *arg)
                 backoff_attempts_beb = std::min(backoff_attempts_beb, max_backoff_attempts);
                 int max_wait_time = ((1 << backoff_attempts_beb) - 1) * slot_time_ms;
                 int wait_time = rand() % (max_wait_time + 1);
+                TRACE_SCOPE_ARG("beb_backoff", backoff_attempts_beb);
                 usleep(wait_time * 10);
                 continue;
             }
@@ -137,6 +149,7 @@ void *slotted_aloha(void *arg)
 {
     int client_id = *(int *)arg;
     delete (int *)arg;
+    TRACE_THREAD_NAME("aloha");
     double prob = (double)1 / (double)total_clients;
     std::default_random_engine generator;
     std::bernoulli_distribution distribution(prob);
@@ -146,6 +159,7 @@ void *slotted_aloha(void *arg)
     { // Check if all clients are completed
         if (distribution(generator))
         {
+            TRACE_SCOPE_ARG("aloha_transmit", client_id);
             // Establish TCP connection
             int sock = 0;
             struct sockaddr_in serv_addr;
@@ -185,7 +199,11 @@ void *slotted_aloha(void *arg)
             char buffer[BUFFER_SIZE] = {0};
             while (true)
             {
-                int valread = read(sock, buffer, BUFFER_SIZE);
+                int valread;
+                {
+                    TRACE_SCOPE_ARG("receive", client_id);
+                    valread = read(sock, buffer, BUFFER_SIZE);
+                }
                 if (valread <= 0)
                     break;
                 std::string data(buffer, valread);
@@ -201,6 +219,7 @@ void *slotted_aloha(void *arg)
                 else if (word.substr(0, 4) == "HUH!")
                 {
                     int wait_time = slot_time_ms;
+                    TRACE_SCOPE_ARG("aloha_collision_wait", client_id);
                     usleep(wait_time);
                     continue;
                 }
@@ -219,6 +238,7 @@ void *slotted_aloha(void *arg)
             completed_clients++;
             return nullptr;
         }
+        TRACE_INSTANT("aloha_idle_slot", client_id);
         usleep(10); // 100 ms
     }
     return nullptr;
@@ -228,6 +248,7 @@ void *sensing_with_beb(void *arg)
 {
     int client_id = *(int *)arg;
     delete (int *)arg;
+    TRACE_THREAD_NAME("cscd");
 
     while (true)
     {
@@ -269,7 +290,11 @@ void *sensing_with_beb(void *arg)
             }
 
             char buffer[1024] = {0};
-            int valread = read(sock, buffer, 1024);
+            int valread;
+            {
+                TRACE_SCOPE_ARG("sense", client_id);
+                valread = read(sock, buffer, 1024);
+            }
             if (valread <= 0)
             {
                 std::cerr << "Client " << client_id << ": Error reading response\n";
@@ -301,6 +326,7 @@ void *sensing_with_beb(void *arg)
                 if (response == "HUH!\n")
                 {
                     // Revert to BEB
+                    TRACE_SCOPE_ARG("cscd_backoff", backoff_time);
                     usleep(backoff_time * 10);
                     backoff_time = std::min(backoff_time * 2, 10); // Exponential backoff with a max limit
                     continue;
@@ -329,6 +355,8 @@ void *sensing_with_beb(void *arg)
 
 int main()
 {
+    TRACE_START("mac_client");
+
     // Set up the SIGPIPE signal handler
     struct sigaction sa;
     sa.sa_handler = handle_sigpipe;
@@ -0,0 +1,447 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <functional>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <cstdio>
+#include <unistd.h>
+#include "json.hpp"
+#include "kernels.hpp"
+#include "sketches.hpp"
+#include "output_writer.hpp"
+#include "parallel_sort.hpp"
+#include "normalize.hpp"
+
+using json = nlohmann::json;
+
+// Microbenchmarks for the kernels in kernels.hpp, plus the code they
+// replaced, on one corpus. Every benchmark runs `warmup` untimed passes and
+// `reps` timed passes; the JSON report has the median and spread per kernel.
+//
+//   ./bench [--corpus words.txt] [--words N] [--vocabulary V] [--k 10] [--p 2]
+//           [--reps 15] [--warmup 3] [--filter substring] [--output bench.json]
+
+// Keeps results alive so the optimizer cannot drop the measured work
+static volatile uint64_t sink;
+
+struct BenchResult
+{
+    std::string name;
+    std::vector<double> samples_ns;
+    uint64_t items;
+
+    json to_json() const
+    {
+        std::vector<double> sorted = samples_ns;
+        std::sort(sorted.begin(), sorted.end());
+        size_t n = sorted.size();
+        double median = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+        double mean = 0;
+        for (double sample : sorted)
+        {
+            mean += sample;
+        }
+        mean /= n;
+        double variance = 0;
+        for (double sample : sorted)
+        {
+            variance += (sample - mean) * (sample - mean);
+        }
+        double stddev = n > 1 ? std::sqrt(variance / (n - 1)) : 0;
+
+        return {{"name", name},
+                {"reps", n},
+                {"items", items},
+                {"median_ns", median},
+                {"mean_ns", mean},
+                {"stddev_ns", stddev},
+                {"min_ns", sorted.front()},
+                {"max_ns", sorted.back()},
+                {"ns_per_item", items ? median / items : 0},
+                {"items_per_second", median > 0 ? items * 1e9 / median : 0}};
+    }
+};
+
+class Bench
+{
+private:
+    int reps;
+    int warmup;
+    std::string filter;
+    std::vector<BenchResult> results;
+
+public:
+    Bench(int reps, int warmup, const std::string &filter) : reps(reps), warmup(warmup), filter(filter) {}
+
+    // setup runs untimed before every pass; body returns a value folded into sink
+    void run(const std::string &name, uint64_t items, const std::function<void()> &setup,
+             const std::function<uint64_t()> &body)
+    {
+        if (!filter.empty() && name.find(filter) == std::string::npos)
+        {
+            return;
+        }
+
+        BenchResult result{name, {}, items};
+        for (int i = 0; i < warmup + reps; i++)
+        {
+            setup();
+            auto start = std::chrono::steady_clock::now();
+            sink = sink + body();
+            auto end = std::chrono::steady_clock::now();
+            if (i >= warmup)
+            {
+                result.samples_ns.push_back(std::chrono::duration<double, std::nano>(end - start).count());
+            }
+        }
+
+        json summary = result.to_json();
+        fprintf(stderr, "%-32s median %12.0f ns  stddev %10.0f ns  %7.2f ns/item\n", name.c_str(),
+                summary["median_ns"].get<double>(), summary["stddev_ns"].get<double>(),
+                summary["ns_per_item"].get<double>());
+        results.push_back(result);
+    }
+
+    json report() const
+    {
+        json benchmarks = json::array();
+        for (const auto &result : results)
+        {
+            benchmarks.push_back(result.to_json());
+        }
+        return benchmarks;
+    }
+};
+
+// Log-uniform ranks give a Zipf-like (s = 1) word distribution
+std::string synthetic_corpus(size_t word_count, size_t vocabulary, uint64_t seed)
+{
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::string data;
+    for (size_t i = 0; i < word_count; i++)
+    {
+        size_t rank = (size_t)std::pow((double)vocabulary, uniform(rng));
+        data += "w" + std::to_string(rank);
+        data += ',';
+    }
+    return data;
+}
+
+int main(int argc, char *argv[])
+{
+    json options = {{"corpus", ""}, {"words", 1000000}, {"vocabulary", 50000}, {"k", 10}, {"p", 2},
+                    {"reps", 15},   {"warmup", 3},      {"filter", ""},         {"output", ""}};
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string key = argv[i];
+        if (key.rfind("--", 0) != 0 || !options.contains(key.substr(2)))
+        {
+            std::cerr << "Unknown option: " << key << std::endl;
+            return 1;
+        }
+        key = key.substr(2);
+        options[key] = options[key].is_string() ? json(argv[i + 1]) : json(std::stoll(argv[i + 1]));
+    }
+
+    std::string data;
+    std::string corpus = options["corpus"];
+    if (!corpus.empty())
+    {
+        std::ifstream file(corpus);
+        if (!file.is_open())
+        {
+            std::cerr << "Failed to open file: " << corpus << std::endl;
+            return 1;
+        }
+        data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    else
+    {
+        data = synthetic_corpus(options["words"], options["vocabulary"], 42);
+    }
+
+    std::vector<std::string> words;
+    for_each_corpus_word(data.data(), data.size(), [&](std::string_view word)
+                         { words.emplace_back(word); });
+    std::vector<std::string_view> views(words.begin(), words.end());
+    size_t k = options["k"], p = options["p"];
+    int reps = options["reps"], warmup = options["warmup"];
+    if (words.empty() || k == 0 || p == 0 || reps <= 0)
+    {
+        std::cerr << "Nothing to benchmark" << std::endl;
+        return 1;
+    }
+
+    // The whole corpus as the client receives it: every window packetized
+    std::string wire;
+    std::vector<size_t> packet_ends;
+    for (size_t offset = 0; offset < words.size(); offset += k)
+    {
+        render_window(words, offset, std::min(k, words.size() - offset), p, wire, packet_ends);
+    }
+    std::vector<std::string> lines;
+    size_t line_start = 0;
+    for (size_t end : packet_ends)
+    {
+        lines.emplace_back(wire, line_start, end - line_start - 1);
+        line_start = end;
+    }
+
+    std::map<std::string, int> frequency;
+    for (const auto &word : words)
+    {
+        frequency[word]++;
+    }
+
+    Bench bench(reps, warmup, options["filter"]);
+    std::vector<std::string> tokens;
+    auto clear_tokens = [&]
+    {
+        std::vector<std::string>().swap(tokens);
+    };
+    auto nothing = [] {};
+
+    // load_words
+    bench.run("tokenize/getline", words.size(), clear_tokens, [&]
+              {
+        std::istringstream file(data);
+        std::string word;
+        while (std::getline(file, word, ','))
+        {
+            tokens.push_back(word);
+        }
+        return tokens.size(); });
+    bench.run("tokenize/memchr", words.size(), clear_tokens, [&]
+              {
+        std::istringstream file(data);
+        tokenize_corpus(file, tokens);
+        return tokens.size(); });
+    bench.run("tokenize/memchr_views", words.size(), nothing, [&]
+              {
+        uint64_t count = 0;
+        for_each_corpus_word(data.data(), data.size(), [&](std::string_view word)
+                             { count += word.size(); });
+        return count; });
+
+    // send_framed_window
+    std::string rendered;
+    std::vector<size_t> rendered_ends;
+    bench.run("packetize/render_window", words.size(), [&]
+              {
+        rendered.clear();
+        rendered_ends.clear(); }, [&]
+              {
+        for (size_t offset = 0; offset < words.size(); offset += k)
+        {
+            render_window(words, offset, std::min(k, words.size() - offset), p, rendered, rendered_ends);
+        }
+        return rendered.size(); });
+
+    // process_words, splitting only
+    bench.run("parse/istringstream", words.size(), nothing, [&]
+              {
+        uint64_t count = 0;
+        for (const auto &line : lines)
+        {
+            std::istringstream line_stream(line);
+            std::string word;
+            while (std::getline(line_stream, word, ','))
+            {
+                count++;
+            }
+        }
+        return count; });
+    bench.run("parse/fields", words.size(), nothing, [&]
+              {
+        uint64_t count = 0;
+        for (const auto &line : lines)
+        {
+            for_each_field(line, [&](std::string_view)
+                           { count++; });
+        }
+        return count; });
+
+    // Count tables, fed pre-split words
+    bench.run("count/std_map", words.size(), nothing, [&]
+              {
+        std::map<std::string, int> table;
+        for (std::string_view word : views)
+        {
+            table[std::string(word)]++;
+        }
+        return table.size(); });
+    bench.run("count/unordered_map", words.size(), nothing, [&]
+              {
+        std::unordered_map<std::string, int> table;
+        for (std::string_view word : views)
+        {
+            table[std::string(word)]++;
+        }
+        return table.size(); });
+    bench.run("count/word_count_table", words.size(), nothing, [&]
+              {
+        WordCountTable table;
+        for (std::string_view word : views)
+        {
+            table.add(word);
+        }
+        return table.size(); });
+    // Output order from an unordered table, against keeping std::map's
+    WordCountTable counted;
+    for (std::string_view word : views)
+    {
+        counted.add(word);
+    }
+    std::vector<WordEntry> entries;
+    auto collect = [&]
+    {
+        entries.clear();
+        counted.for_each([&](std::string_view word, uint64_t count)
+                         { entries.emplace_back(word, count); });
+    };
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    bench.run("order/std_sort_words", counted.size(), collect, [&]
+              {
+        std::sort(entries.begin(), entries.end());
+        return entries.size(); });
+    bench.run("order/radix_words_1_thread", counted.size(), collect, [&]
+              {
+        radix_sort_words(entries, 1);
+        return entries.size(); });
+    bench.run("order/radix_words", counted.size(), collect, [&]
+              {
+        radix_sort_words(entries, threads);
+        return entries.size(); });
+    bench.run("order/by_count", counted.size(), collect, [&]
+              {
+        sort_by_count(entries, threads);
+        return entries.size(); });
+    bench.run("count_ordered/table_radix", words.size(), nothing, [&]
+              {
+        WordCountTable table;
+        for (std::string_view word : views)
+        {
+            table.add(word);
+        }
+        std::vector<WordEntry> sorted;
+        table.for_each([&](std::string_view word, uint64_t count)
+                       { sorted.emplace_back(word, count); });
+        radix_sort_words(sorted, threads);
+        return sorted.size(); });
+    // Normalization ahead of counting; most words come back as views
+    NormalizeOptions fold_only, everything;
+    fold_only.fold_case = true;
+    everything.fold_case = everything.strip_punctuation = everything.unicode = true;
+    bench.run("normalize/fold_case", words.size(), nothing, [&]
+              {
+        std::string scratch;
+        uint64_t bytes = 0;
+        for (std::string_view word : views)
+        {
+            bytes += normalize_word(word, fold_only, scratch).size();
+        }
+        return bytes; });
+    bench.run("normalize/all", words.size(), nothing, [&]
+              {
+        std::string scratch;
+        uint64_t bytes = 0;
+        for (std::string_view word : views)
+        {
+            bytes += normalize_word(word, everything, scratch).size();
+        }
+        return bytes; });
+    // top_k mode's bounded summary
+    bench.run("count/space_saving_1024", words.size(), nothing, [&]
+              {
+        SpaceSaving summary(1024);
+        for (std::string_view word : views)
+        {
+            summary.add(word);
+        }
+        return summary.max_error(); });
+
+    // process_words end to end: split and count
+    bench.run("parse_count/istringstream_map", words.size(), nothing, [&]
+              {
+        std::map<std::string, int> table;
+        for (const auto &line : lines)
+        {
+            std::istringstream line_stream(line);
+            std::string word;
+            while (std::getline(line_stream, word, ','))
+            {
+                table[word]++;
+            }
+        }
+        return table.size(); });
+    bench.run("parse_count/fields_map", words.size(), nothing, [&]
+              {
+        std::map<std::string, int> table;
+        for (const auto &line : lines)
+        {
+            for_each_field(line, [&](std::string_view word)
+                           { table[std::string(word)]++; });
+        }
+        return table.size(); });
+    bench.run("parse_count/fields_table", words.size(), nothing, [&]
+              {
+        WordCountTable table;
+        for (const auto &line : lines)
+        {
+            for_each_field(line, [&](std::string_view word)
+                           { table.add(word); });
+        }
+        return table.size(); });
+
+    // write_frequency
+    std::string output_file = "bench_frequency_" + std::to_string(getpid()) + ".txt";
+    bench.run("write_frequency/ofstream", frequency.size(), nothing, [&]
+              {
+        std::ofstream out(output_file);
+        write_frequency_text(out, frequency);
+        out.close();
+        return (uint64_t)out.good(); });
+    bench.run("write_frequency/format_only", frequency.size(), nothing, [&]
+              {
+        std::ostringstream out;
+        write_frequency_text(out, frequency);
+        return out.str().size(); });
+    bench.run("write_frequency/buffered_text", frequency.size(), nothing, [&]
+              { return (uint64_t)write_file(output_file, format_frequency(OutputFormat::Text, frequency)); });
+    bench.run("write_frequency/buffered_binary", frequency.size(), nothing, [&]
+              { return (uint64_t)write_file(output_file, format_frequency(OutputFormat::Binary, frequency)); });
+    remove(output_file.c_str());
+
+    json report = {{"corpus",
+                    {{"source", corpus.empty() ? "synthetic" : corpus},
+                     {"bytes", data.size()},
+                     {"words", words.size()},
+                     {"distinct_words", frequency.size()}}},
+                   {"k", k},
+                   {"p", p},
+                   {"reps", reps},
+                   {"warmup", warmup},
+                   {"benchmarks", bench.report()}};
+
+    std::string output = options["output"];
+    if (output.empty())
+    {
+        std::cout << report.dump(2) << std::endl;
+    }
+    else
+    {
+        std::ofstream out(output);
+        out << report.dump(2) << std::endl;
+        std::cerr << "Results written to " << output << std::endl;
+    }
+    return 0;
+}
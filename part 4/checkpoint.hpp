@@ -0,0 +1,149 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+// Client download checkpoint: the offset up to which every window has been
+// counted, and the counts themselves, so an interrupted download resumes
+// there without counting any word twice.
+//
+// File layout (native byte order, written whole to <path>.tmp and renamed
+// over <path>, so a crash leaves either the old or the new checkpoint):
+//   CheckpointHeader
+//   entry_count x { uint32_t length, length bytes, uint64_t count }
+//   uint64_t hash_bytes() of everything above
+
+#include <string>
+#include <string_view>
+#include <utility>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include "kernels.hpp"
+
+struct CheckpointHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t total_words; // corpus size when written, to detect a changed corpus
+    uint64_t offset;
+    uint64_t entry_count;
+};
+
+constexpr char CHECKPOINT_MAGIC[8] = {'W', 'C', 'C', 'K', 'P', 'T', '\0', '\0'};
+constexpr uint32_t CHECKPOINT_VERSION = 1;
+
+struct Checkpoint
+{
+    uint64_t total_words = 0; // 0: not known yet
+    uint64_t offset = 0;
+
+    bool save(const std::string &path, const WordCountTable &counts) const
+    {
+        std::string data(sizeof(CheckpointHeader), '\0');
+        CheckpointHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+        header.version = CHECKPOINT_VERSION;
+        header.total_words = total_words;
+        header.offset = offset;
+        header.entry_count = counts.size();
+        memcpy(&data[0], &header, sizeof(header));
+
+        counts.for_each([&](std::string_view word, uint64_t count)
+                        {
+            uint32_t length = word.size();
+            data.append((const char *)&length, sizeof(length));
+            data.append(word);
+            data.append((const char *)&count, sizeof(count)); });
+        uint64_t checksum = hash_bytes(data.data(), data.size());
+        data.append((const char *)&checksum, sizeof(checksum));
+
+        std::string temporary = path + ".tmp";
+        int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            return false;
+        }
+        size_t written = 0;
+        while (written < data.size())
+        {
+            ssize_t n = write(fd, data.data() + written, data.size() - written);
+            if (n <= 0)
+            {
+                close(fd);
+                unlink(temporary.c_str());
+                return false;
+            }
+            written += n;
+        }
+        bool synced = fsync(fd) == 0;
+        close(fd);
+        return synced && rename(temporary.c_str(), path.c_str()) == 0;
+    }
+
+    // False when there is no checkpoint or it is damaged; counts is only
+    // replaced on success
+    bool load(const std::string &path, WordCountTable &counts)
+    {
+        FILE *in = fopen(path.c_str(), "rb");
+        if (in == nullptr)
+        {
+            return false;
+        }
+        std::string data;
+        char buffer[65536];
+        size_t n;
+        while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0)
+        {
+            data.append(buffer, n);
+        }
+        fclose(in);
+
+        CheckpointHeader header;
+        if (data.size() < sizeof(header) + sizeof(uint64_t))
+        {
+            return false;
+        }
+        memcpy(&header, data.data(), sizeof(header));
+        uint64_t checksum;
+        size_t payload = data.size() - sizeof(checksum);
+        memcpy(&checksum, data.data() + payload, sizeof(checksum));
+        if (memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != CHECKPOINT_VERSION || checksum != hash_bytes(data.data(), payload))
+        {
+            return false;
+        }
+
+        WordCountTable loaded;
+        size_t cursor = sizeof(header);
+        for (uint64_t i = 0; i < header.entry_count; i++)
+        {
+            uint32_t length;
+            uint64_t count;
+            if (cursor + sizeof(length) > payload)
+            {
+                return false;
+            }
+            memcpy(&length, data.data() + cursor, sizeof(length));
+            cursor += sizeof(length);
+            if (cursor + length + sizeof(count) > payload)
+            {
+                return false;
+            }
+            std::string_view word(data.data() + cursor, length);
+            cursor += length;
+            memcpy(&count, data.data() + cursor, sizeof(count));
+            cursor += sizeof(count);
+            loaded.add(word, count);
+        }
+
+        total_words = header.total_words;
+        offset = header.offset;
+        counts = std::move(loaded);
+        return true;
+    }
+};
+
+#endif
@@ -11,169 +11,1796 @@
 #include "json.hpp"
 #include <pthread.h>
 #include <vector>
+#include <deque>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <unordered_map>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shm_corpus.hpp"
+#include "udp_protocol.hpp"
+#include "trace.hpp"
+#include "kernels.hpp"
+#include "socket_tuning.hpp"
+#include "checkpoint.hpp"
+#include "coro_runtime.hpp"
+#include "sketches.hpp"
+#include "output_writer.hpp"
+#include "parallel_sort.hpp"
+#include "ngrams.hpp"
+#include "normalize.hpp"
 
 using json = nlohmann::json;
 
+// How a client fetches windows over TCP. Written to the config's "autotune"
+// section by ./client --autotune; k == 0 leaves the window size to the
+// server, which also rules out pipelining.
+struct TransferPlan
+{
+    int k = 0;
+    int p = 0;
+    int pipeline_depth = 1;
+    int rcvbuf = 0; // 0: kernel default
+    int sndbuf = 0;
+    bool sessions = false; // "NEXT" on a server-side session instead of "GET <offset>"
+
+    static TransferPlan from_json(const json &config)
+    {
+        TransferPlan plan;
+        plan.sessions = config.value("sessions", false);
+        if (config.contains("autotune"))
+        {
+            const json &tuned = config["autotune"];
+            plan.k = tuned.value("k", 0);
+            plan.p = tuned.value("p", plan.k);
+            plan.pipeline_depth = tuned.value("pipeline_depth", 1);
+            plan.rcvbuf = tuned.value("rcvbuf", 0);
+            plan.sndbuf = tuned.value("sndbuf", 0);
+        }
+        return plan;
+    }
+
+    json to_json() const
+    {
+        return {{"k", k}, {"p", p}, {"pipeline_depth", pipeline_depth}, {"rcvbuf", rcvbuf}, {"sndbuf", sndbuf}};
+    }
+};
+
 class Client
 {
 private:
     struct sockaddr_in serv_addr;
-    std::vector<std::map<std::string, int>> word_frequencies;
+    std::vector<WordCountTable> word_frequencies; // ordered only when written out
+    size_t top_k;                            // 0: exact counts
+    std::vector<SpaceSaving> heavy_hitters; // per client, in top_k mode
+    std::string distinct_mode;               // "off", "with_counts", "only" or "server"
+    std::vector<HyperLogLog> distinct_words; // per client, unless distinct_mode is "off"
+    struct SampledCount
+    {
+        std::string word;
+        double estimate;
+        double half_width; // of the confidence interval
+    };
+    std::vector<std::vector<SampledCount>> sampled_counts; // per client, in sample mode
+    std::vector<NgramCounter> ngrams;   // per client, in n-gram mode
+    NormalizeOptions normalize;
+    size_t stop_k;                      // 0: always read the whole corpus
+    std::vector<Checkpoint> stopped_at; // per client: where the top stop_k settled, offset 0 if it never did
     json config;
-    pthread_mutex_t word_frequencies_mutex;
+    OutputFormat output_format = OutputFormat::Text; // of exact counts; the other modes always write text
+    bool order_by_count = false;                     // exact counts by word, or most frequent first
+    unsigned sort_threads;
     std::vector<double> client_times;
+    std::vector<double> output_times; // per client, spent in write_frequency
+    ShmCorpusReader shm_corpus;
+    TransferPlan plan;
+    SocketProfile socket_profile;
+
+public:
+    Client(const std::string &config_file)
+    {
+        std::ifstream f(config_file);
+        config = json::parse(f);
+        int num_clients = config["num_clients"].get<int>();
+        word_frequencies.resize(num_clients);
+        client_times.resize(num_clients);
+        output_times.resize(num_clients);
+        if (!parse_output_format(config.value("output_format", "text"), output_format))
+        {
+            std::cerr << "Unknown output format " << config["output_format"] << ", using text" << std::endl;
+        }
+        // "output_order": "word" or "count"; counting uses an unordered table
+        // and the entries are only sorted, on "sort_threads" threads, when
+        // written out
+        order_by_count = config.value("output_order", "word") == "count";
+        sort_threads = std::max(1u, config.value("sort_threads", std::thread::hardware_concurrency()));
+        sampled_counts.resize(num_clients);
+        stop_k = config.contains("early_stop") ? config["early_stop"].value("top_k", 20) : 0;
+        stopped_at.resize(num_clients);
+        // "top_k": K keeps a fixed number of Space-Saving counters instead of
+        // an exact table, for vocabularies that do not fit in memory
+        top_k = config.value("top_k", 0);
+        if (top_k > 0)
+        {
+            heavy_hitters.assign(num_clients, SpaceSaving(config.value("top_k_capacity", std::max<size_t>(1024, 10 * top_k))));
+        }
+        // Evictions can raise or drop a Space-Saving count at any point, so
+        // a ranking read from them never settles
+        if (stop_k > 0 && top_k > 0)
+        {
+            std::cerr << "early_stop needs exact counts and is ignored with top_k" << std::endl;
+            stop_k = 0;
+        }
+        // "distinct" estimates the vocabulary size: alongside the counts, on
+        // its own without building a table, or from the server's sketch
+        distinct_mode = config.value("distinct", "off");
+        if (distinct_mode != "off" && distinct_mode != "with_counts" && distinct_mode != "only" &&
+            distinct_mode != "server")
+        {
+            std::cerr << "Unknown distinct mode " << distinct_mode << ", using off" << std::endl;
+            distinct_mode = "off";
+        }
+        if (distinct_mode != "off")
+        {
+            distinct_words.assign(num_clients, HyperLogLog(config.value("hll_precision", 14)));
+        }
+        // "normalize": true, or {"case": bool, "punctuation": bool, "unicode": bool}
+        if (config.contains("normalize"))
+        {
+            const json &options = config["normalize"];
+            bool all = options.is_boolean() && options.get<bool>();
+            normalize.fold_case = options.is_object() ? options.value("case", true) : all;
+            normalize.strip_punctuation = options.is_object() ? options.value("punctuation", true) : all;
+            normalize.unicode = options.is_object() ? options.value("unicode", true) : all;
+        }
+        // "ngram": N (2 to MAX_NGRAM) counts runs of N consecutive words instead
+        // of words. They need the words in corpus order, which UDP does not
+        // guarantee.
+        int ngram = config.value("ngram", 0);
+        if (ngram >= 2 && config.value("transport", "tcp") == "udp")
+        {
+            std::cerr << "N-grams need an ordered transport, counting words instead" << std::endl;
+        }
+        else if (ngram >= 2)
+        {
+            try
+            {
+                ngrams.assign(num_clients, NgramCounter(ngram));
+            }
+            catch (const std::invalid_argument &e)
+            {
+                std::cerr << e.what() << ", counting words instead" << std::endl;
+            }
+        }
+        plan = TransferPlan::from_json(config);
+        try
+        {
+            socket_profile = SocketProfile::from_json(config);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Invalid socket settings, using defaults: " << e.what() << std::endl;
+        }
+
+        if (config.value("transport", "tcp") == "shm" &&
+            !shm_corpus.attach(config["shm_name"].get<std::string>()))
+        {
+            std::cerr << "Failed to attach shared memory corpus, falling back to tcp" << std::endl;
+        }
+    }
+
+    // socket_flags: e.g. SOCK_NONBLOCK for sockets driven by an EventLoop
+    bool open_socket(int &sock, int rcvbuf, int sndbuf, int socket_flags)
+    {
+        if ((sock = socket(AF_INET, SOCK_STREAM | socket_flags, 0)) < 0)
+        {
+            std::cerr << "Socket creation error" << std::endl;
+            return false;
+        }
+
+        // Before connect, so the window scale offered in the SYN fits the buffer.
+        // Autotuned buffer sizes take precedence over the profile's.
+        apply_socket_profile(sock, socket_profile);
+        if (rcvbuf > 0)
+        {
+            setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        }
+        if (sndbuf > 0)
+        {
+            setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+        }
+
+        serv_addr.sin_family = AF_INET;
+        serv_addr.sin_port = htons(config["server_port"]);
+
+        if (inet_pton(AF_INET, config["server_ip"].get<std::string>().c_str(), &serv_addr.sin_addr) <= 0)
+        {
+            std::cerr << "Invalid address/ Address not supported" << std::endl;
+            close(sock);
+            return false;
+        }
+        return true;
+    }
+
+    bool connect_to_server(int &sock, int rcvbuf = 0, int sndbuf = 0)
+    {
+        if (!open_socket(sock, rcvbuf, sndbuf, 0))
+        {
+            return false;
+        }
+        if (connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
+        {
+            std::cerr << "Connection Failed" << std::endl;
+            close(sock);
+            return false;
+        }
+        return true;
+    }
+
+    // Non-blocking connection for the coroutine clients
+    Task<bool> connect_async(EventLoop &loop, int &sock, int rcvbuf, int sndbuf)
+    {
+        if (!open_socket(sock, rcvbuf, sndbuf, SOCK_NONBLOCK))
+        {
+            co_return false;
+        }
+        bool connected = co_await async_connect(loop, sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr));
+        if (!connected)
+        {
+            std::cerr << "Connection Failed" << std::endl;
+            close(sock);
+            co_return false;
+        }
+        co_return true;
+    }
+
+    bool read_line(int sock, std::string &pending, std::string &line)
+    {
+        char buffer[1024];
+        size_t newline;
+        while ((newline = pending.find('\n')) == std::string::npos)
+        {
+            int valread = read(sock, buffer, sizeof(buffer));
+            if (valread <= 0)
+            {
+                return false;
+            }
+            rearm_quickack(sock, socket_profile);
+            pending.append(buffer, valread);
+        }
+        line = pending.substr(0, newline);
+        pending.erase(0, newline + 1);
+        return true;
+    }
+
+    // One per connection; re-arms quick ACKs after every read, like read_line
+    LineReader line_reader(EventLoop &loop, int sock)
+    {
+        return LineReader(loop, sock, [this, sock]
+                          { rearm_quickack(sock, socket_profile); });
+    }
+
+    // Requests windows with "GET <offset>", or "GET <offset> <k> <p>" when the
+    // plan fixes k. The "WIN <offset> <count> <remaining>" header says how many
+    // words follow, so the client keeps in step even when the server's k is
+    // changed between windows. With a fixed k the offsets of later windows are
+    // known up front and up to pipeline_depth requests are kept outstanding.
+    // The server may clamp k (max_window, or a reload); when a window comes
+    // back with another count, later requests step by that count and replies
+    // to requests already sent at the old offsets are drained and dropped.
+    // On a session the server tracks the offset, so "NEXT" can be pipelined
+    // whatever k is.
+    // No new windows are requested after deadline; outstanding ones are drained.
+    // on_window(offset, count, remaining) runs after each complete window and
+    // may return false to stop.
+    template <typename OnWord, typename OnWindow>
+    Task<bool> fetch_windows(EventLoop &loop, int sock, const TransferPlan &plan, int start_offset,
+                             std::chrono::steady_clock::time_point deadline, OnWord &&on_word, OnWindow &&on_window)
+    {
+        int depth = plan.k > 0 || plan.sessions ? std::max(1, plan.pipeline_depth) : 1;
+        int next_offset = start_offset; // next window to request
+        int expected = start_offset;    // offset the next reply has to start at
+        int step = plan.k;              // words the server last answered a GET with
+        std::deque<int> requested;      // offset of each outstanding GET, -1 for NEXT
+        bool first = true;
+        bool done = false;
+        LineReader reader = line_reader(loop, sock);
+        std::string line;
+
+        while (true)
+        {
+            std::string requests;
+            while (!done && (int)requested.size() < depth && (first || std::chrono::steady_clock::now() < deadline))
+            {
+                first = false;
+                requests += plan.sessions ? "NEXT" : "GET " + std::to_string(next_offset);
+                requested.push_back(plan.sessions ? -1 : next_offset);
+                if (plan.k > 0)
+                {
+                    requests += " " + std::to_string(plan.k) + " " + std::to_string(plan.p);
+                    next_offset += step;
+                }
+                requests += "\n";
+                if (depth == 1)
+                {
+                    break;
+                }
+            }
+            if (!requests.empty())
+            {
+                bool sent = co_await async_send(loop, sock, requests.c_str(), requests.length());
+                if (!sent)
+                {
+                    co_return false;
+                }
+            }
+            if (requested.empty())
+            {
+                co_return true;
+            }
+
+            bool received;
+            {
+                TRACE_SCOPE_ARG("wait_window", expected);
+                received = co_await reader.read_line(line);
+            }
+            if (!received)
+            {
+                co_return false;
+            }
+            // Sent before the server changed the window size, so at an offset
+            // that is no longer the next one
+            bool stale = requested.front() >= 0 && requested.front() != expected;
+            requested.pop_front();
+            if (line == "$$")
+            {
+                done = done || !stale;
+                continue;
+            }
+
+            int win_offset, count, remaining;
+            if (sscanf(line.c_str(), "WIN %d %d %d", &win_offset, &count, &remaining) != 3 ||
+                (!stale && win_offset != expected))
+            {
+                std::cerr << "Unexpected reply: " << line << std::endl;
+                co_return false;
+            }
+
+            TRACE_SCOPE_ARG("receive_window", count);
+            int words_received = 0;
+            while (words_received < count)
+            {
+                bool more = co_await reader.read_line(line);
+                if (!more)
+                {
+                    co_return false;
+                }
+                for_each_field(line, [&](std::string_view word)
+                               {
+                    if (!stale)
+                    {
+                        on_word(word);
+                    }
+                    words_received++; });
+            }
+            if (stale)
+            {
+                continue;
+            }
+            expected = win_offset + count;
+            if (plan.k == 0 || count != step)
+            {
+                step = std::max(count, 1);
+                next_offset = expected;
+            }
+            if (!on_window(win_offset, count, remaining))
+            {
+                co_return false;
+            }
+            if (remaining == 0)
+            {
+                done = true;
+            }
+        }
+    }
+
+    std::string checkpoint_path(int client_id)
+    {
+        return config.value("checkpoint_dir", ".") + "/checkpoint_client_" + std::to_string(client_id) + ".bin";
+    }
+
+    void count_word(int client_id, std::string_view word)
+    {
+        if (normalize.enabled())
+        {
+            thread_local std::string scratch;
+            word = normalize_word(word, normalize, scratch);
+            if (word.empty())
+            {
+                return;
+            }
+        }
+        if (!distinct_words.empty())
+        {
+            distinct_words[client_id].add(word);
+            if (distinct_mode == "only")
+            {
+                return;
+            }
+        }
+        if (!ngrams.empty())
+        {
+            ngrams[client_id].add(word);
+        }
+        else if (top_k > 0)
+        {
+            heavy_hitters[client_id].add(word);
+        }
+        else
+        {
+            word_frequencies[client_id].add(word);
+        }
+    }
+
+    void order_entries(std::vector<WordEntry> &entries)
+    {
+        TRACE_SCOPE_ARG("sort", entries.size());
+        if (order_by_count)
+        {
+            sort_by_count(entries, sort_threads);
+        }
+        else
+        {
+            radix_sort_words(entries, sort_threads);
+        }
+    }
+
+    // Views into word_frequencies[client_id], valid until it next changes
+    std::vector<WordEntry> collect_entries(int client_id)
+    {
+        std::vector<WordEntry> entries;
+        entries.reserve(word_frequencies[client_id].size());
+        word_frequencies[client_id].for_each([&](std::string_view word, uint64_t count)
+                                             { entries.emplace_back(word, count); });
+        return entries;
+    }
+
+    // The n most frequent words counted so far, most frequent first (ties by
+    // word); error is only non-zero for Space-Saving counters
+    std::vector<SpaceSaving::Counter> current_top(int client_id, size_t n)
+    {
+        std::vector<WordEntry> entries = collect_entries(client_id);
+        n = std::min(n, entries.size());
+        std::partial_sort(entries.begin(), entries.begin() + n, entries.end(),
+                          [](const WordEntry &a, const WordEntry &b)
+                          { return a.second != b.second ? a.second > b.second : a.first < b.first; });
+        std::vector<SpaceSaving::Counter> result;
+        for (size_t i = 0; i < n; i++)
+        {
+            result.push_back({std::string(entries[i].first), entries[i].second, 0});
+        }
+        return result;
+    }
+
+    // Whether the remaining words can still reorder the top stop_k. Checks
+    // each adjacent pair within the top stop_k, and the last of them against
+    // the next stop_k words. Every word below those is at most as frequent as
+    // the last one checked: "bound" covers them with that pair, "normal" adds
+    // their summed chance of overtaking the last of the top stop_k, each
+    // taken at the last checked count. "bound" stops only once no gap can
+    // close even if every remaining word went to the trailing word of a pair;
+    // "normal" treats the remaining words as draws at the frequencies seen so
+    // far and stops once the summed probability of a swap is below
+    // 1 - confidence. Only exact counts are ranked, never top_k's.
+    //
+    //   "early_stop": {"top_k": 20, "confidence": 0.99, "test": "normal",
+    //                  "min_fraction": 0.01}
+    bool ranking_settled(int client_id, uint64_t seen, uint64_t remaining)
+    {
+        const json &options = config["early_stop"];
+        if (seen == 0 || seen < options.value("min_fraction", 0.01) * (seen + remaining))
+        {
+            return false;
+        }
+        std::vector<SpaceSaving::Counter> leaders = current_top(client_id, 2 * stop_k);
+        if (leaders.size() < stop_k)
+        {
+            return remaining == 0;
+        }
+        bool bound = options.value("test", "normal") == "bound";
+        double allowed = 1 - options.value("confidence", 0.99);
+        auto swap_probability = [&](uint64_t leading, uint64_t trailing)
+        {
+            double gap = (double)leading - trailing;
+            double pa = (double)leading / seen, pb = (double)trailing / seen;
+            double mean = remaining * (pa - pb);
+            double variance = remaining * (pa + pb - (pa - pb) * (pa - pb));
+            if (variance <= 0)
+            {
+                return gap + mean <= 0 ? 1.0 : 0.0;
+            }
+            return 0.5 * std::erfc((gap + mean) / std::sqrt(2 * variance));
+        };
+        double flip_probability = 0;
+        for (size_t b = 1; b < leaders.size(); b++)
+        {
+            size_t a = std::min(b - 1, stop_k - 1);
+            if (bound)
+            {
+                if ((double)leaders[a].count - leaders[b].count <= (double)remaining)
+                {
+                    return false;
+                }
+                continue;
+            }
+            flip_probability += swap_probability(leaders[a].count, leaders[b].count);
+            if (flip_probability > allowed)
+            {
+                return false;
+            }
+        }
+        size_t below = word_frequencies[client_id].size() - leaders.size();
+        if (!bound && below > 0)
+        {
+            flip_probability += below * swap_probability(leaders[stop_k - 1].count, leaders.back().count);
+        }
+        return flip_probability <= allowed;
+    }
+
+    // Checkpoint files hold exact counts, so top_k and distinct-only modes
+    // only resume within the process
+    bool checkpointing() const
+    {
+        return top_k == 0 && ngrams.empty() && distinct_mode != "only" && config.value("checkpoint_interval_ms", 1000) > 0;
+    }
+
+    // Counts from progress.offset on. A window's words are staged and only
+    // counted once the whole window has arrived, so progress.offset is always
+    // a clean cut to resume from. Returns true at the end of the corpus.
+    Task<bool> process_words(EventLoop &loop, int sock, int client_id, Checkpoint &progress)
+    {
+        // Only this thread touches word_frequencies[client_id], no lock needed
+        WordCountTable &frequency = word_frequencies[client_id];
+        std::vector<std::string> staged;
+        int interval_ms = checkpointing() ? config.value("checkpoint_interval_ms", 1000) : 0;
+        auto last_save = std::chrono::steady_clock::now();
+        bool corpus_changed = false;
+        bool stopped_early = false;
+        bool windows_seen = false;
+        uint64_t next_check = 0;
+
+        bool completed = co_await fetch_windows(
+            loop, sock, plan, progress.offset, std::chrono::steady_clock::time_point::max(),
+            [&](std::string_view word)
+            { staged.emplace_back(word); },
+            [&](int win_offset, int count, int remaining)
+            {
+                windows_seen = true;
+                uint64_t total = (uint64_t)win_offset + count + remaining;
+                if (progress.total_words != 0 && progress.total_words != total)
+                {
+                    corpus_changed = true;
+                    return false;
+                }
+                progress.total_words = total;
+                for (std::string &word : staged)
+                {
+                    count_word(client_id, word);
+                }
+                staged.clear();
+                progress.offset = win_offset + count;
+
+                if (stop_k > 0 && progress.offset >= next_check)
+                {
+                    TRACE_SCOPE("early_stop");
+                    next_check = progress.offset + std::max<uint64_t>(1, total / 200);
+                    if (ranking_settled(client_id, progress.offset, remaining))
+                    {
+                        stopped_at[client_id] = progress;
+                        stopped_early = true;
+                        return false;
+                    }
+                }
+
+                if (interval_ms > 0 && std::chrono::steady_clock::now() - last_save >= std::chrono::milliseconds(interval_ms))
+                {
+                    TRACE_SCOPE("checkpoint");
+                    progress.save(checkpoint_path(client_id), frequency);
+                    last_save = std::chrono::steady_clock::now();
+                }
+                return true;
+            });
+
+        // A "$$" straight away carries no size: the checkpoint may have been
+        // cut at the very end, or the corpus may have shrunk below it. The
+        // last word before the offset tells the two apart.
+        if (completed && !windows_seen && progress.offset > 0 && progress.total_words != 0)
+        {
+            TransferPlan probe;
+            probe.k = 1;
+            probe.p = 1;
+            uint64_t total = 0;
+            completed = co_await fetch_windows(
+                loop, sock, probe, progress.offset - 1, std::chrono::steady_clock::time_point::min(),
+                [](std::string_view) {},
+                [&](int win_offset, int count, int remaining)
+                {
+                    total = (uint64_t)win_offset + count + remaining;
+                    return true;
+                });
+            corpus_changed = completed && total != progress.total_words;
+            completed = completed && !corpus_changed;
+        }
+
+        if (corpus_changed)
+        {
+            std::cerr << "Client " << client_id << ": corpus changed since the checkpoint, starting over" << std::endl;
+            reset_counts(client_id);
+            progress = Checkpoint();
+            unlink(checkpoint_path(client_id).c_str());
+        }
+        co_return completed || stopped_early;
+    }
+
+    // Drops everything counted so far, for a client that starts over
+    void reset_counts(int client_id)
+    {
+        word_frequencies[client_id].clear();
+        if (top_k > 0)
+        {
+            heavy_hitters[client_id].clear();
+        }
+        if (!ngrams.empty())
+        {
+            ngrams[client_id].clear();
+        }
+        if (!distinct_words.empty())
+        {
+            distinct_words[client_id] = HyperLogLog(distinct_words[client_id].get_precision());
+        }
+    }
+
+    // Attaches the connection to this client's server-side session with
+    // "RESUME <token> <offset>", rewinding it to the last counted window. A
+    // new session is opened at offset when there is none yet or the server no
+    // longer knows the token (expired, or the server restarted).
+    Task<bool> open_session(EventLoop &loop, int sock, std::string &token, uint64_t offset)
+    {
+        LineReader reader = line_reader(loop, sock);
+        std::string line, message;
+        if (!token.empty())
+        {
+            message = "RESUME " + token + " " + std::to_string(offset) + "\n";
+            bool replied = co_await async_send(loop, sock, message.c_str(), message.length()) &&
+                           co_await reader.read_line(line);
+            if (!replied)
+            {
+                co_return false;
+            }
+            if (line.compare(0, 8, "RESUMED ") == 0)
+            {
+                co_return true;
+            }
+            std::cerr << "Session not resumed (" << line << "), opening a new one" << std::endl;
+        }
+
+        message = "SESSION " + std::to_string(offset) + "\n";
+        char received[33];
+        bool replied = co_await async_send(loop, sock, message.c_str(), message.length()) &&
+                       co_await reader.read_line(line);
+        if (!replied || sscanf(line.c_str(), "SESSION %32s", received) != 1)
+        {
+            std::cerr << "Unexpected reply: " << line << std::endl;
+            co_return false;
+        }
+        token = received;
+        co_return true;
+    }
+
+    // TCP download that survives disconnects: resumes from the checkpoint
+    // file if one exists, and after a lost connection reconnects with capped
+    // exponential backoff (retry_base_ms doubling up to retry_max_ms). Gives
+    // up after max_retries consecutive attempts without progress.
+    Task<void> download(EventLoop &loop, int client_id)
+    {
+        WordCountTable &frequency = word_frequencies[client_id];
+        std::string path = checkpoint_path(client_id);
+        bool checkpointing = this->checkpointing();
+        int base_ms = config.value("retry_base_ms", 100);
+        int max_ms = config.value("retry_max_ms", 5000);
+        int max_retries = config.value("max_retries", 8);
+
+        Checkpoint progress;
+        std::string session_token;
+        if (checkpointing && progress.load(path, frequency))
+        {
+            std::cout << "Client " << client_id << " resuming from offset " << progress.offset << std::endl;
+            if (!distinct_words.empty())
+            {
+                // The sketch only depends on which words were seen
+                frequency.for_each([&](std::string_view word, uint64_t)
+                                   { distinct_words[client_id].add(word); });
+            }
+        }
+
+        int failures = 0;
+        while (true)
+        {
+            uint64_t before = progress.offset;
+            int sock = 0;
+            bool connected;
+            {
+                TRACE_SCOPE("connect");
+                connected = co_await connect_async(loop, sock, plan.rcvbuf, plan.sndbuf);
+            }
+            if (connected && plan.sessions)
+            {
+                connected = co_await open_session(loop, sock, session_token, progress.offset);
+                if (!connected)
+                {
+                    close(sock);
+                }
+            }
+            if (connected)
+            {
+                bool completed = co_await process_words(loop, sock, client_id, progress);
+                close(sock);
+                if (completed)
+                {
+                    if (checkpointing)
+                    {
+                        unlink(path.c_str());
+                    }
+                    co_return;
+                }
+                if (checkpointing)
+                {
+                    progress.save(path, frequency);
+                }
+            }
+
+            if (progress.offset > before)
+            {
+                failures = 0;
+            }
+            if (++failures > max_retries)
+            {
+                std::cerr << "Client " << client_id << ": giving up at offset " << progress.offset << std::endl;
+                co_return;
+            }
+            int delay_ms = std::min<long>(max_ms, (long)base_ms << std::min(failures - 1, 20));
+            std::cerr << "Client " << client_id << ": interrupted at offset " << progress.offset << ", retrying in "
+                      << delay_ms << " ms" << std::endl;
+            TRACE_SCOPE_ARG("backoff", delay_ms);
+            co_await loop.sleep(std::chrono::milliseconds(delay_ms));
+        }
+    }
+
+    // Same offset handshake as process_words, but the server only grants the
+    // window and the words are read directly from the shared memory corpus.
+    // Returns false when the server cannot grant windows of the segment
+    // attached here (it is gone, or from another server run) or the
+    // connection drops, so the caller can fetch the corpus over TCP instead.
+    bool process_words_shm(int sock, int client_id)
+    {
+        int offset = 0;
+        std::string pending;
+        std::string line;
+
+        while (true)
+        {
+            std::string message = "SHM " + std::to_string(offset) + "\n";
+            send(sock, message.c_str(), message.length(), 0);
+
+            bool received;
+            {
+                TRACE_SCOPE_ARG("wait_grant", offset);
+                received = read_line(sock, pending, line);
+            }
+            if (!received)
+            {
+                std::cerr << "Client " << client_id << ": connection lost, switching to TCP" << std::endl;
+                return false;
+            }
+            if (line == "$$")
+            {
+                return true;
+            }
+            if (line.compare(0, 4, "ERR ") == 0)
+            {
+                std::cerr << "Client " << client_id << ": " << line.substr(4) << ", switching to TCP" << std::endl;
+                return false;
+            }
+
+            int win_offset, count, remaining;
+            unsigned long long generation;
+            bool parsed = sscanf(line.c_str(), "WIN %d %d %d %llu", &win_offset, &count, &remaining, &generation) == 4;
+            if (parsed && generation != shm_corpus.generation())
+            {
+                std::cerr << "Client " << client_id << ": shared memory corpus is from another server run, switching to TCP"
+                          << std::endl;
+                return false;
+            }
+            if (!parsed || win_offset < 0 || count < 0 || (uint64_t)win_offset + count > shm_corpus.word_count())
+            {
+                std::cerr << "Client " << client_id << ": unexpected grant: " << line << ", switching to TCP"
+                          << std::endl;
+                return false;
+            }
+
+            TRACE_SCOPE_ARG("count_shm", count);
+            for (int i = 0; i < count; i++)
+            {
+                count_word(client_id, shm_corpus.word(win_offset + i));
+            }
+            offset = win_offset + count;
+
+            if (remaining == 0)
+            {
+                return true;
+            }
+        }
+    }
+
+    bool send_nacks(int sock, const std::vector<WordRange> &ranges)
+    {
+        std::vector<std::string> messages = encode_nacks(ranges);
+        std::vector<struct mmsghdr> msgs(messages.size());
+        std::vector<struct iovec> iovecs(messages.size());
+        for (size_t i = 0; i < messages.size(); i++)
+        {
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            iovecs[i].iov_base = (void *)messages[i].data();
+            iovecs[i].iov_len = messages[i].size();
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        return sendmmsg(sock, msgs.data(), msgs.size(), 0) == (int)msgs.size();
+    }
+
+    // Datagram mode: keeps "udp_window" windows of k words in flight, places
+    // every datagram by its offset and NACKs only the holes after a quiet
+    // period, so one lost datagram never stalls the windows behind it.
+    // Returns false when a word is too long for a datagram, so the caller
+    // can fetch the corpus over TCP instead.
+    bool process_words_udp(int client_id)
+    {
+        int sock;
+        if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+        {
+            std::cerr << "Client " << client_id << ": UDP socket creation error" << std::endl;
+            return true;
+        }
+
+        struct sockaddr_in udp_addr;
+        memset(&udp_addr, 0, sizeof(udp_addr));
+        udp_addr.sin_family = AF_INET;
+        udp_addr.sin_port = htons(config["udp_port"]);
+        if (inet_pton(AF_INET, config["server_ip"].get<std::string>().c_str(), &udp_addr.sin_addr) <= 0 ||
+            connect(sock, (struct sockaddr *)&udp_addr, sizeof(udp_addr)) < 0)
+        {
+            std::cerr << "Client " << client_id << ": UDP connect failed" << std::endl;
+            close(sock);
+            return true;
+        }
+
+        uint32_t k = config["k"].get<int>();
+        size_t max_windows = config.value("udp_window", 4);
+        int timeout_ms = config.value("udp_timeout_ms", 20);
+        int max_timeouts = config.value("udp_max_timeouts", 100);
+
+        RangeBitmap received;
+        bool total_known = false;
+        uint32_t total = 0;
+        uint32_t next_offset = 0;
+        std::deque<WordRange> in_flight;
+        int timeouts = 0;
+
+        const int batch = 32;
+        std::vector<char> buffers(batch * UDP_MAX_DATAGRAM);
+        struct mmsghdr msgs[batch];
+        struct iovec iovecs[batch];
+
+        while (!total_known || received.count() < total)
+        {
+            // Until the first reply tells us the corpus size only one window is requested
+            std::vector<WordRange> requests;
+            while (in_flight.size() < (total_known ? max_windows : 1) && (!total_known || next_offset < total))
+            {
+                uint32_t count = total_known ? std::min(k, total - next_offset) : k;
+                in_flight.push_back({next_offset, count});
+                requests.push_back({next_offset, count});
+                next_offset += count;
+            }
+            if (!requests.empty())
+            {
+                send_nacks(sock, requests);
+            }
+
+            struct pollfd pfd = {sock, POLLIN, 0};
+            int ready;
+            {
+                TRACE_SCOPE("udp_wait");
+                ready = poll(&pfd, 1, timeout_ms);
+            }
+            if (ready < 0)
+            {
+                break;
+            }
+            if (ready == 0)
+            {
+                if (++timeouts > max_timeouts)
+                {
+                    std::cerr << "Client " << client_id << ": giving up after " << timeouts << " timeouts" << std::endl;
+                    break;
+                }
+                std::vector<WordRange> holes;
+                for (const auto &window : in_flight)
+                {
+                    uint32_t end = total_known ? std::min(window.first + window.second, total) : window.first + window.second;
+                    std::vector<WordRange> missing = total_known ? received.missing(window.first, end)
+                                                                 : std::vector<WordRange>{window};
+                    holes.insert(holes.end(), missing.begin(), missing.end());
+                }
+                TRACE_INSTANT("udp_nack", holes.size());
+                send_nacks(sock, holes);
+                continue;
+            }
+
+            memset(msgs, 0, sizeof(msgs));
+            for (int i = 0; i < batch; i++)
+            {
+                iovecs[i].iov_base = &buffers[i * UDP_MAX_DATAGRAM];
+                iovecs[i].iov_len = UDP_MAX_DATAGRAM;
+                msgs[i].msg_hdr.msg_iov = &iovecs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+            int n = recvmmsg(sock, msgs, batch, MSG_DONTWAIT, NULL);
+            if (n <= 0)
+            {
+                continue;
+            }
+            timeouts = 0;
+
+            TRACE_SCOPE_ARG("udp_receive_batch", n);
+            for (int i = 0; i < n; i++)
+            {
+                const char *datagram = &buffers[i * UDP_MAX_DATAGRAM];
+                UdpDatagramHeader header;
+                if (!decode_udp_header(datagram, msgs[i].msg_len, header))
+                {
+                    continue;
+                }
+                if (!total_known)
+                {
+                    total = header.total;
+                    total_known = true;
+                    received.resize(total);
+                }
+                if (header.flags & UDP_FLAG_WORD_TOO_LONG)
+                {
+                    std::cerr << "Client " << client_id << ": word " << header.offset
+                              << " does not fit in a datagram, switching to TCP" << std::endl;
+                    close(sock);
+                    return false;
+                }
+                if ((uint64_t)header.offset + header.count > total)
+                {
+                    continue;
+                }
+
+                const char *cursor = datagram + sizeof(UdpDatagramHeader);
+                const char *end = datagram + msgs[i].msg_len;
+                for (uint32_t w = 0; w < header.count; w++)
+                {
+                    const char *comma = (const char *)memchr(cursor, ',', end - cursor);
+                    const char *word_end = comma != nullptr ? comma : end;
+                    if (received.set(header.offset + w))
+                    {
+                        count_word(client_id, std::string_view(cursor, word_end - cursor));
+                    }
+                    cursor = comma != nullptr ? comma + 1 : end;
+                }
+            }
+
+            while (!in_flight.empty() &&
+                   received.missing(in_flight.front().first,
+                                    std::min(in_flight.front().first + in_flight.front().second, total))
+                       .empty())
+            {
+                in_flight.pop_front();
+            }
+        }
+
+        close(sock);
+        return true;
+    }
 
-public:
-    Client(const std::string &config_file)
+    // One timed fetch of the corpus with the given plan on a fresh connection,
+    // in words per second
+    double measure_goodput(const TransferPlan &trial, double seconds)
     {
-        std::ifstream f(config_file);
-        config = json::parse(f);
-        int num_clients = config["num_clients"].get<int>();
-        word_frequencies.resize(num_clients);
-        client_times.resize(num_clients);
-        pthread_mutex_init(&word_frequencies_mutex, NULL);
+        int sock;
+        if (!connect_to_server(sock, trial.rcvbuf, trial.sndbuf))
+        {
+            return 0;
+        }
+        long words = 0;
+        auto start = std::chrono::steady_clock::now();
+        auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                    std::chrono::duration<double>(seconds));
+        // A blocking socket, so the coroutine runs straight through
+        EventLoop loop;
+        bool completed = sync_wait(loop, fetch_windows(
+            loop, sock, trial, 0, deadline, [&](std::string_view)
+            { words++; },
+            [](int, int, int)
+            { return true; }));
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        close(sock);
+        return completed && elapsed.count() > 0 ? words / elapsed.count() : 0;
     }
 
-    ~Client()
+    double median_goodput(const TransferPlan &trial, double seconds, int repetitions)
     {
-        pthread_mutex_destroy(&word_frequencies_mutex);
+        std::vector<double> samples;
+        for (int i = 0; i < repetitions; i++)
+        {
+            samples.push_back(measure_goodput(trial, seconds));
+        }
+        std::sort(samples.begin(), samples.end());
+        return samples[samples.size() / 2];
     }
 
-    bool connect_to_server(int &sock)
+    // Fetches the single window "GET 0 <k> <k>"; returns seconds, bytes and
+    // the words the server sent, which max_window may hold below k
+    bool time_window(int sock, int k, double &seconds, size_t &bytes, int &words, int &total)
     {
-        if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        std::string pending, line;
+        std::string message = "GET 0 " + std::to_string(k) + " " + std::to_string(k) + "\n";
+        auto start = std::chrono::steady_clock::now();
+        send(sock, message.c_str(), message.length(), 0);
+        int win_offset, count, remaining;
+        if (!read_line(sock, pending, line) ||
+            sscanf(line.c_str(), "WIN %d %d %d", &win_offset, &count, &remaining) != 3)
         {
-            std::cerr << "Socket creation error" << std::endl;
             return false;
         }
+        bytes = 0;
+        int words_received = 0;
+        while (words_received < count)
+        {
+            if (!read_line(sock, pending, line))
+            {
+                return false;
+            }
+            bytes += line.size() + 1;
+            for_each_field(line, [&](std::string_view)
+                           { words_received++; });
+        }
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        words = count;
+        total = count + remaining;
+        return true;
+    }
 
-        serv_addr.sin_family = AF_INET;
-        serv_addr.sin_port = htons(config["server_port"]);
+    // ./client --local words.txt: counts a local copy of the corpus with no
+    // server, as client 0. The file is memory-mapped and cut after commas
+    // into one slice per thread ("local_threads", default one per core); each
+    // thread counts its slice into its own table and the tables are merged
+    // pairwise. The phase times are the network-free ceiling for a download.
+    void run_local(const std::string &path)
+    {
+        // Slices are counted independently, so only exact word counts apply
+        top_k = 0;
+        stop_k = 0;
+        ngrams.clear();
+        distinct_words.clear();
+        distinct_mode = "off";
+        config.erase("sample");
 
-        if (inet_pton(AF_INET, config["server_ip"].get<std::string>().c_str(), &serv_addr.sin_addr) <= 0)
+        auto start = std::chrono::high_resolution_clock::now();
+        int fd = open(path.c_str(), O_RDONLY);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) < 0)
         {
-            std::cerr << "Invalid address/ Address not supported" << std::endl;
-            return false;
+            std::cerr << "Failed to open file: " << path << std::endl;
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            return;
         }
+        size_t size = info.st_size;
+        const char *data = nullptr;
+        if (size > 0)
+        {
+            void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED)
+            {
+                std::cerr << "Failed to map file: " << path << std::endl;
+                close(fd);
+                return;
+            }
+            data = (const char *)mapped;
+        }
+        close(fd);
 
-        if (connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
+        unsigned threads = std::max(1u, config.value("local_threads", std::thread::hardware_concurrency()));
+        std::vector<size_t> bounds = {0};
+        for (unsigned t = 1; t < threads; t++)
         {
-            std::cerr << "Connection Failed" << std::endl;
-            return false;
+            // Each slice ends just after a comma, so no word is cut in two
+            size_t cut = std::max(bounds.back(), size * t / threads);
+            const char *comma = cut < size ? (const char *)memchr(data + cut, ',', size - cut) : nullptr;
+            bounds.push_back(comma == nullptr ? size : comma - data + 1);
         }
+        bounds.push_back(size);
+        auto mapped = std::chrono::high_resolution_clock::now();
 
-        return true;
+        std::vector<WordCountTable> tables(threads);
+        std::vector<uint64_t> words(threads, 0);
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; t++)
+        {
+            workers.emplace_back([&, t]
+                                 {
+                TRACE_THREAD_NAME("local");
+                TRACE_SCOPE_ARG("count_local", bounds[t + 1] - bounds[t]);
+                std::string scratch;
+                for_each_corpus_word(data + bounds[t], bounds[t + 1] - bounds[t], [&](std::string_view word)
+                                     {
+                    words[t]++;
+                    if (normalize.enabled())
+                    {
+                        word = normalize_word(word, normalize, scratch);
+                        if (word.empty())
+                        {
+                            return;
+                        }
+                    }
+                    tables[t].add(word); }); });
+        }
+        for (std::thread &worker : workers)
+        {
+            worker.join();
+        }
+        auto counted = std::chrono::high_resolution_clock::now();
+
+        for (unsigned step = 1; step < threads; step *= 2)
+        {
+            workers.clear();
+            for (unsigned t = 0; t + step < threads; t += 2 * step)
+            {
+                workers.emplace_back([&, t, step]
+                                     {
+                    tables[t].merge(tables[t + step]);
+                    tables[t + step].clear(); });
+            }
+            for (std::thread &worker : workers)
+            {
+                worker.join();
+            }
+        }
+        word_frequencies[0] = std::move(tables[0]);
+        if (size > 0)
+        {
+            munmap((void *)data, size);
+        }
+        auto merged = std::chrono::high_resolution_clock::now();
+
+        write_frequency(0);
+        auto end = std::chrono::high_resolution_clock::now();
+
+        uint64_t total_words = std::accumulate(words.begin(), words.end(), uint64_t(0));
+        std::chrono::duration<double> map_time = mapped - start, count_time = counted - mapped,
+                                      merge_time = merged - counted, output_time = end - merged, total_time = end - start;
+        std::cout << "Counted " << total_words << " words (" << word_frequencies[0].size() << " distinct) in " << size
+                  << " bytes on " << threads << " threads" << std::endl;
+        std::cout << "Map: " << map_time.count() << " s, count: " << count_time.count() << " s ("
+                  << total_words / std::max(count_time.count(), 1e-9) << " words/s, "
+                  << size / std::max(count_time.count(), 1e-9) / 1e6 << " MB/s), merge: " << merge_time.count()
+                  << " s, output: " << output_time.count() << " s" << std::endl;
+        std::cout << "Total time taken: " << total_time.count() << " seconds" << std::endl;
     }
 
-    void process_words(int sock, int client_id)
+    // Calibrates against the server, then searches k, p, pipelining depth and
+    // socket buffers one at a time for the best goodput and stores the winner
+    // in the "autotune" section of config_file, which later runs pick up.
+    //   RTT: median round trip of an out-of-range "GET", answered with "$$".
+    //   Bandwidth and per-request cost: least-squares fit of window time
+    //   against window bytes over windows of 1 to 4096 words.
+    // The model suggests a k whose transfer time is 90% of the window's cost;
+    // the search measures it alongside powers of 4.
+    void autotune(const std::string &config_file)
     {
-        int offset = 0;
-        std::string message;
-        char buffer[1024] = {0};
-        int req_words = config["k"].get<int>();
-        int words_received = 0;
+        double trial_seconds = config.value("autotune_trial_ms", 200) / 1000.0;
+        int repetitions = config.value("autotune_repetitions", 3);
 
-        while (true)
+        int sock;
+        if (!connect_to_server(sock))
         {
-            if (offset == 0)
+            return;
+        }
+        std::string pending, line;
+        std::vector<double> round_trips;
+        for (int i = 0; i < 20; i++)
+        {
+            std::string message = "GET " + std::to_string(INT_MAX) + "\n";
+            auto start = std::chrono::steady_clock::now();
+            send(sock, message.c_str(), message.length(), 0);
+            if (!read_line(sock, pending, line))
+            {
+                std::cerr << "Autotune: server closed the connection" << std::endl;
+                close(sock);
+                return;
+            }
+            round_trips.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+        std::sort(round_trips.begin(), round_trips.end());
+        double rtt = round_trips[round_trips.size() / 2];
+
+        int total = 0;
+        std::vector<double> xs, ys; // bytes, seconds
+        double word_bytes = 8;
+        int largest_k = 65536; // lowered to the server's max_window once it clamps
+        for (int k : {1, 16, 256, 4096})
+        {
+            for (int i = 0; i < 5; i++)
+            {
+                double seconds;
+                size_t bytes;
+                int words;
+                if (!time_window(sock, k, seconds, bytes, words, total))
+                {
+                    std::cerr << "Autotune: calibration window failed" << std::endl;
+                    close(sock);
+                    return;
+                }
+                xs.push_back(bytes);
+                ys.push_back(seconds);
+                word_bytes = (double)bytes / std::max(words, 1);
+                if (words < std::min(k, total))
+                {
+                    largest_k = words;
+                }
+            }
+            if (k >= total || k > largest_k)
+            {
+                break;
+            }
+        }
+        close(sock);
+        if (total == 0)
+        {
+            std::cerr << "Autotune: the server has no words" << std::endl;
+            return;
+        }
+
+        double mean_x = 0, mean_y = 0;
+        for (size_t i = 0; i < xs.size(); i++)
+        {
+            mean_x += xs[i] / xs.size();
+            mean_y += ys[i] / ys.size();
+        }
+        double covariance = 0, variance = 0;
+        for (size_t i = 0; i < xs.size(); i++)
+        {
+            covariance += (xs[i] - mean_x) * (ys[i] - mean_y);
+            variance += (xs[i] - mean_x) * (xs[i] - mean_x);
+        }
+        double slope = variance > 0 ? covariance / variance : 0; // seconds per byte
+        double request_cost = std::max(mean_y - slope * mean_x, 0.0);
+        double bandwidth = slope > 0 ? 1 / slope : 0;
+        double server_cost = std::max(request_cost - rtt, 0.0);
+
+        std::cout << "Autotune: rtt " << rtt * 1e6 << " us, bandwidth " << bandwidth / 1e6 << " MB/s, per-request cost "
+                  << request_cost * 1e6 << " us (server " << server_cost * 1e6 << " us), corpus " << total << " words"
+                  << std::endl;
+
+        TransferPlan best;
+        double best_goodput = -1;
+        auto consider = [&](const TransferPlan &trial)
+        {
+            double goodput = median_goodput(trial, trial_seconds, repetitions);
+            std::cout << "Autotune: k=" << trial.k << " p=" << trial.p << " depth=" << trial.pipeline_depth
+                      << " rcvbuf=" << trial.rcvbuf << " sndbuf=" << trial.sndbuf << ": " << goodput << " words/s"
+                      << std::endl;
+            if (goodput > best_goodput)
+            {
+                best_goodput = goodput;
+                best = trial;
+            }
+        };
+
+        std::vector<int> ks;
+        for (int k = 16; k < total && k <= largest_k; k *= 4)
+        {
+            ks.push_back(k);
+        }
+        ks.push_back(std::min(total, largest_k));
+        if (bandwidth > 0)
+        {
+            double model_k = 9 * request_cost * bandwidth / word_bytes;
+            ks.push_back((int)std::min<double>(std::max(model_k, 1.0), std::min(total, largest_k)));
+        }
+        std::sort(ks.begin(), ks.end());
+        ks.erase(std::unique(ks.begin(), ks.end()), ks.end());
+        for (int k : ks)
+        {
+            TransferPlan trial;
+            trial.k = trial.p = k;
+            consider(trial);
+        }
+
+        int k = best.k;
+        for (int p : {1, k / 16, k / 4})
+        {
+            if (p >= 1 && p < k)
+            {
+                TransferPlan trial = best;
+                trial.p = p;
+                consider(trial);
+            }
+        }
+
+        TransferPlan base = best;
+        for (int depth : {2, 4, 8})
+        {
+            if ((long)base.k * depth < 2L * total)
+            {
+                TransferPlan trial = base;
+                trial.pipeline_depth = depth;
+                consider(trial);
+            }
+        }
+
+        base = best;
+        for (int buffer : {65536, 262144, 1048576, 4194304})
+        {
+            TransferPlan trial = base;
+            trial.rcvbuf = trial.sndbuf = buffer;
+            consider(trial);
+        }
+
+        std::ifstream in(config_file);
+        json updated = json::parse(in);
+        in.close();
+        updated["autotune"] = best.to_json();
+        updated["autotune"]["measured"] = {{"rtt_us", rtt * 1e6},
+                                           {"bandwidth_bytes_per_second", bandwidth},
+                                           {"request_cost_us", request_cost * 1e6},
+                                           {"server_cost_us", server_cost * 1e6},
+                                           {"goodput_words_per_second", best_goodput}};
+        std::ofstream out(config_file);
+        out << updated.dump(4) << std::endl;
+
+        std::cout << "Autotune: best " << best.to_json().dump() << " at " << best_goodput << " words/s, written to "
+                  << config_file << std::endl;
+    }
+
+    // Two-sided standard normal quantile for the given confidence
+    static double normal_quantile(double confidence)
+    {
+        double low = 0, high = 10;
+        for (int i = 0; i < 100; i++)
+        {
+            double middle = (low + high) / 2;
+            if (std::erfc(middle / std::sqrt(2.0)) > 1 - confidence)
             {
-                message = std::to_string(offset) + "\n";
-                send(sock, message.c_str(), message.length(), 0);
+                low = middle;
             }
-            if (words_received >= req_words)
+            else
             {
-                message = std::to_string(offset) + "\n";
-                send(sock, message.c_str(), message.length(), 0);
-                words_received = 0;
+                high = middle;
             }
+        }
+        return (low + high) / 2;
+    }
+
+    // Approximate counts from a random sample of fixed-size blocks of the
+    // corpus (cluster sampling without replacement). With M blocks of which
+    // m are sampled, a word seen c_i times in sampled block i is estimated at
+    // M * mean(c_i), with variance M^2 (1 - m/M) var(c_i) / m. Blocks are
+    // fetched `batch` at a time, with one "RANGES" request or pipelined
+    // "GET"s, until every word estimated at min_share of the corpus or more
+    // has a confidence interval within target_error of its estimate. A block
+    // larger than the server's max_window shrinks to it.
+    //
+    //   "sample": {"block": 1000, "batch": 16, "target_error": 0.05,
+    //              "confidence": 0.95, "min_share": 0.001, "min_blocks": 30,
+    //              "seed": 0, "multi_range": true}
+    Task<void> sample_words(EventLoop &loop, int client_id)
+    {
+        const json &options = config["sample"];
+        int block = std::max(1, options.value("block", config.value("k", 1000)));
+        size_t batch = std::max(1, options.value("batch", 16));
+        double target_error = options.value("target_error", 0.05);
+        double z = normal_quantile(options.value("confidence", 0.95));
+        double min_share = options.value("min_share", 0.001);
+        size_t min_blocks = std::max(2, options.value("min_blocks", 30));
+        uint64_t seed = options.value("seed", 0);
+        bool multi_range = options.value("multi_range", true);
+        int p = plan.p > 0 ? plan.p : config["p"].get<int>();
+
+        int sock = 0;
+        bool connected = co_await connect_async(loop, sock, plan.rcvbuf, plan.sndbuf);
+        if (!connected)
+        {
+            co_return;
+        }
+
+        // The corpus size comes with any window header, and the first block
+        // shows whether the server clamps it to max_window
+        LineReader reader = line_reader(loop, sock);
+        std::string line;
+        std::string probe = "GET 0 " + std::to_string(block) + " " + std::to_string(p) + "\n";
+        bool replied = co_await async_send(loop, sock, probe.c_str(), probe.length()) &&
+                       co_await reader.read_line(line);
+        int win_offset, count, remaining;
+        if (!replied || sscanf(line.c_str(), "WIN %d %d %d", &win_offset, &count, &remaining) != 3)
+        {
+            std::cerr << "Client " << client_id << ": unexpected reply: " << line << std::endl;
+            close(sock);
+            co_return;
+        }
+        uint64_t total = (uint64_t)win_offset + count + remaining;
+        for (int words_received = 0; replied && words_received < count;)
+        {
+            replied = co_await reader.read_line(line);
+            for_each_field(line, [&](std::string_view)
+                           { words_received++; });
+        }
+        if (remaining > 0 && count != block)
+        {
+            std::cerr << "Client " << client_id << ": server caps windows at " << count << " words, sampling blocks of "
+                      << count << " instead of " << block << std::endl;
+            block = count;
+        }
 
-            memset(buffer, 0, sizeof(buffer));
-            int valread = read(sock, buffer, 1024);
+        size_t blocks = (total + block - 1) / block;
+        std::vector<uint32_t> order(blocks);
+        std::iota(order.begin(), order.end(), 0);
+        std::mt19937_64 generator(seed != 0 ? seed : std::random_device{}());
+        std::shuffle(order.begin(), order.end(), generator);
+
+        // Sum and sum of squares of each word's per-block counts; blocks
+        // without the word add zero to both
+        std::unordered_map<std::string, std::pair<double, double>> moments;
+        std::unordered_map<std::string, int> block_counts;
+        std::string scratch; // for normalize_word, as in count_word
+        size_t requested = 0, sampled = 0;
+        while (replied && requested < blocks)
+        {
+            size_t n = std::min(batch, blocks - requested);
+            std::string request = multi_range ? "RANGES " : "";
+            for (size_t i = 0; i < n; i++)
+            {
+                std::string offset = std::to_string((uint64_t)order[requested + i] * block);
+                if (multi_range)
+                {
+                    request += (i > 0 ? "," : "") + offset + ":" + std::to_string(block);
+                }
+                else
+                {
+                    request += "GET " + offset + " " + std::to_string(block) + " " + std::to_string(p) + "\n";
+                }
+            }
+            if (multi_range)
+            {
+                request += "\n";
+            }
+            replied = co_await async_send(loop, sock, request.c_str(), request.length());
 
-            if (strcmp(buffer, "$$\n") == 0 || valread <= 0)
+            for (size_t i = 0; replied && i < n; i++)
+            {
+                replied = co_await reader.read_line(line);
+                if (!replied || line == "$$")
+                {
+                    continue;
+                }
+                if (sscanf(line.c_str(), "WIN %d %d %d", &win_offset, &count, &remaining) != 3)
+                {
+                    std::cerr << "Client " << client_id << ": unexpected reply: " << line << std::endl;
+                    replied = false;
+                    break;
+                }
+                // Only the last block may be short; anything else means the
+                // server's cap or the corpus changed under the estimate
+                if ((uint64_t)count != std::min<uint64_t>(block, total - win_offset) ||
+                    (uint64_t)win_offset + count + remaining != total)
+                {
+                    std::cerr << "Client " << client_id << ": window of " << count << " words at " << win_offset
+                              << " does not match the sampling plan, stopping" << std::endl;
+                    replied = false;
+                    break;
+                }
+                sampled++;
+                block_counts.clear();
+                int words_received = 0;
+                while (replied && words_received < count)
+                {
+                    replied = co_await reader.read_line(line);
+                    for_each_field(line, [&](std::string_view word)
+                                   {
+                        words_received++;
+                        word = normalize_word(word, normalize, scratch);
+                        if (!word.empty())
+                        {
+                            block_counts[std::string(word)]++;
+                        } });
+                }
+                for (const auto &entry : block_counts)
+                {
+                    std::pair<double, double> &moment = moments[entry.first];
+                    moment.first += entry.second;
+                    moment.second += (double)entry.second * entry.second;
+                }
+            }
+            if (!replied)
             {
                 break;
             }
+            requested += n;
 
-            std::istringstream iss(buffer);
-            std::string line;
-            while (std::getline(iss, line))
+            if (sampled >= min_blocks || requested == blocks)
             {
-                std::istringstream line_stream(line);
-                std::string word;
-                while (std::getline(line_stream, word, ','))
+                bool precise = true;
+                for (const auto &entry : moments)
                 {
-                    if (word == "EOF")
+                    double estimate, half_width;
+                    sample_estimate(entry.second, sampled, blocks, z, estimate, half_width);
+                    if (estimate >= min_share * total && half_width > target_error * estimate)
                     {
-                        return;
+                        precise = false;
+                        break;
                     }
-                    words_received++;
-                    // printf("Client %d received word: %s\n", client_id, word.c_str());
-
-                    pthread_mutex_lock(&word_frequencies_mutex);
-                    word_frequencies[client_id][word]++;
-                    offset++;
-                    pthread_mutex_unlock(&word_frequencies_mutex);
+                }
+                if (precise)
+                {
+                    break;
                 }
             }
         }
+        close(sock);
+        if (!replied)
+        {
+            std::cerr << "Client " << client_id << ": connection lost while sampling" << std::endl;
+        }
+
+        std::vector<SampledCount> &result = sampled_counts[client_id];
+        for (const auto &entry : moments)
+        {
+            SampledCount counted{entry.first, 0, 0};
+            sample_estimate(entry.second, sampled, blocks, z, counted.estimate, counted.half_width);
+            result.push_back(counted);
+        }
+        std::sort(result.begin(), result.end(), [](const SampledCount &a, const SampledCount &b)
+                  { return a.word < b.word; });
+        std::cout << "Client " << client_id << " sampled " << sampled << " of " << blocks << " blocks ("
+                  << (blocks > 0 ? 100.0 * sampled / blocks : 0) << "% of the corpus)" << std::endl;
     }
 
-    void write_frequency(int client_id)
+    static void sample_estimate(const std::pair<double, double> &moment, size_t sampled, size_t blocks, double z,
+                                double &estimate, double &half_width)
+    {
+        double m = sampled, M = blocks;
+        double mean = moment.first / m;
+        double variance = m > 1 ? std::max(0.0, (moment.second - m * mean * mean) / (m - 1)) : 0;
+        estimate = M * mean;
+        half_width = z * M * std::sqrt((1 - m / M) * variance / m);
+    }
+
+    // Merges the server's whole-corpus sketch ("DISTINCT") into this client's
+    bool fetch_distinct(int client_id)
     {
-        std::string filename = "output_client_" + std::to_string(client_id) + ".txt";
-        std::ofstream out(filename);
+        int sock = 0;
+        if (!connect_to_server(sock))
+        {
+            return false;
+        }
+        send(sock, "DISTINCT\n", 9, 0);
+        std::string pending, line;
+        bool received = read_line(sock, pending, line);
+        close(sock);
 
-        for (const auto &pair : word_frequencies[client_id])
+        unsigned long long estimate;
+        int precision, hex_start = 0;
+        HyperLogLog sketch;
+        if (!received || sscanf(line.c_str(), "DISTINCT %llu %d %n", &estimate, &precision, &hex_start) != 2 ||
+            hex_start == 0 || !sketch.from_hex(precision, std::string_view(line).substr(hex_start)))
         {
-            out << pair.first << ", " << pair.second << "\n";
+            std::cerr << "Client " << client_id << ": unexpected reply: " << line.substr(0, 64) << std::endl;
+            return false;
         }
+        // A client configured with another precision adopts the server's
+        distinct_words[client_id] = sketch;
+        return true;
+    }
+
+    void write_frequency(int client_id)
+    {
+        std::string filename = "output_client_" + std::to_string(client_id);
+        std::ostringstream out; // the small text outputs of the other modes
+        std::string buffer;
+        bool exact = false;
 
-        out.close();
+        if (distinct_mode == "only" || distinct_mode == "server")
+        {
+            out << "distinct, " << distinct_words[client_id].estimate() << "\n";
+        }
+        else if (config.contains("sample"))
+        {
+            // "word, estimate, half width of the confidence interval"
+            for (const SampledCount &counted : sampled_counts[client_id])
+            {
+                out << counted.word << ", " << std::llround(counted.estimate) << ", "
+                    << std::llround(counted.half_width) << "\n";
+            }
+        }
+        else if (!ngrams.empty())
+        {
+            // Output only: the n-grams' words joined by spaces
+            std::vector<std::pair<std::string, uint64_t>> joined;
+            joined.reserve(ngrams[client_id].size());
+            ngrams[client_id].for_each([&](const std::string &ngram, uint64_t count)
+                                       { joined.emplace_back(ngram, count); });
+            std::vector<WordEntry> entries(joined.begin(), joined.end());
+            order_entries(entries);
+            buffer = format_frequency(output_format, entries);
+            exact = true;
+        }
+        else if (stop_k > 0)
+        {
+            // "word, count, count projected to the whole corpus"
+            const Checkpoint &stop = stopped_at[client_id];
+            double scale = stop.offset > 0 ? (double)stop.total_words / stop.offset : 1;
+            for (const SpaceSaving::Counter &counter : current_top(client_id, stop_k))
+            {
+                out << counter.word << ", " << counter.count << ", " << std::llround(counter.count * scale) << "\n";
+            }
+            if (stop.offset > 0)
+            {
+                std::cout << "Client " << client_id << " top " << stop_k << " settled at offset " << stop.offset
+                          << " of " << stop.total_words << std::endl;
+            }
+        }
+        else if (top_k > 0)
+        {
+            const SpaceSaving &summary = heavy_hitters[client_id];
+            write_top_k_text(out, summary.top(top_k));
+            std::cout << "Client " << client_id << " top " << top_k << " of " << summary.total()
+                      << " words, counts over-estimated by at most " << summary.max_error() << std::endl;
+        }
+        else
+        {
+            std::vector<WordEntry> entries = collect_entries(client_id);
+            order_entries(entries);
+            buffer = format_frequency(output_format, entries);
+            exact = true;
+        }
+        if (exact)
+        {
+            filename += output_extension(output_format);
+        }
+        else
+        {
+            buffer = out.str();
+            filename += ".txt";
+        }
+        if (!write_file(filename, buffer))
+        {
+            std::cerr << "Client " << client_id << ": could not write " << filename << std::endl;
+            return;
+        }
 
         std::cout << "Client " << client_id << " output written to " << filename << std::endl;
+        if (!distinct_words.empty())
+        {
+            std::cout << "Client " << client_id << " distinct words: about " << distinct_words[client_id].estimate()
+                      << std::endl;
+        }
     }
 
-    void run_client(int client_id)
+    Task<void> run_client(EventLoop &loop, int client_id)
     {
         auto start = std::chrono::high_resolution_clock::now();
 
-        int sock = 0;
-        if (!connect_to_server(sock))
+        if (distinct_mode == "server")
         {
-            return;
+            fetch_distinct(client_id);
+        }
+        else if (config.contains("sample"))
+        {
+            co_await sample_words(loop, client_id);
+        }
+        else if (config.value("transport", "tcp") == "udp")
+        {
+            if (!process_words_udp(client_id))
+            {
+                reset_counts(client_id);
+                co_await download(loop, client_id);
+            }
+        }
+        else if (shm_corpus.attached())
+        {
+            int sock = 0;
+            bool connected;
+            {
+                TRACE_SCOPE("connect");
+                connected = connect_to_server(sock);
+            }
+            if (!connected)
+            {
+                co_return;
+            }
+            bool served = process_words_shm(sock, client_id);
+            close(sock);
+            if (!served)
+            {
+                reset_counts(client_id);
+                co_await download(loop, client_id);
+            }
+        }
+        else
+        {
+            co_await download(loop, client_id);
         }
 
-        process_words(sock, client_id);
-        close(sock);
-
-        write_frequency(client_id);
+        auto output_start = std::chrono::high_resolution_clock::now();
+        {
+            TRACE_SCOPE("write_frequency");
+            write_frequency(client_id);
+        }
 
         auto end = std::chrono::high_resolution_clock::now();
         std::chrono::duration<double> diff = end - start;
+        std::chrono::duration<double> output_diff = end - output_start;
         client_times[client_id] = diff.count();
+        output_times[client_id] = output_diff.count();
 
-        std::cout << "Client " << client_id << " completed in " << diff.count() << " seconds" << std::endl;
+        std::cout << "Client " << client_id << " completed in " << diff.count() << " seconds (output "
+                  << output_diff.count() << " seconds)" << std::endl;
     }
 
+    // Runs clients first, first + stride, ... as coroutines on one loop
     static void *run_client_thread(void *arg)
     {
         ThreadArgs *args = static_cast<ThreadArgs *>(arg);
-        args->client->run_client(args->client_id);
+        TRACE_THREAD_NAME("client");
+        EventLoop loop;
+        for (int id = args->first; id < (int)args->client->client_times.size(); id += args->stride)
+        {
+            loop.spawn(args->client->run_client(loop, id));
+        }
+        loop.run();
         delete args;
         return NULL;
     }
 
+    // TCP clients are coroutines, so "client_threads" threads can drive any
+    // number of them; the default is still a thread per client. UDP and
+    // shared-memory clients block and always get a thread each.
     void run()
     {
         auto start = std::chrono::high_resolution_clock::now();
 
         int num_clients = config["num_clients"].get<int>();
-        std::vector<pthread_t> client_threads(num_clients);
+        int num_threads = num_clients;
+        if (config.value("transport", "tcp") != "udp" && !shm_corpus.attached())
+        {
+            num_threads = std::max(1, std::min(config.value("client_threads", num_clients), num_clients));
+        }
+        std::vector<pthread_t> client_threads(num_threads);
 
-        for (int i = 0; i < num_clients; ++i)
+        for (int i = 0; i < num_threads; ++i)
         {
-            ThreadArgs *args = new ThreadArgs{this, i};
+            ThreadArgs *args = new ThreadArgs{this, i, num_threads};
             int rc = pthread_create(&client_threads[i], NULL, run_client_thread, args);
             if (rc)
             {
@@ -182,7 +1809,7 @@ public:
             }
         }
 
-        for (int i = 0; i < num_clients; ++i)
+        for (int i = 0; i < num_threads; ++i)
         {
             pthread_join(client_threads[i], NULL);
         }
@@ -193,27 +1820,64 @@ public:
         std::cout << "All clients completed." << std::endl;
         std::cout << "Total time taken: " << total_time.count() << " seconds" << std::endl;
 
-        double avg_time = 0;
+        double avg_time = 0, avg_output_time = 0;
         for (int i = 0; i < num_clients; ++i)
         {
             avg_time += client_times[i];
+            avg_output_time += output_times[i];
         }
         avg_time /= num_clients;
+        avg_output_time /= num_clients;
 
         std::cout << "Average time per client: " << avg_time << " seconds" << std::endl;
+        std::cout << "Average output time per client: " << avg_output_time << " seconds" << std::endl;
     }
 
 private:
     struct ThreadArgs
     {
         Client *client;
-        int client_id;
+        int first;
+        int stride;
     };
 };
 
-int main()
+// ./client [config_file]             count the corpus
+// ./client --autotune [config_file]  tune the transfer plan for this link
+int main(int argc, char *argv[])
 {
-    Client client("config_4.json");
-    client.run();
+    TRACE_START("client");
+    std::string config_file = "config_4.json";
+    std::string local_file;
+    bool tune = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::string(argv[i]) == "--autotune")
+        {
+            tune = true;
+        }
+        else if (std::string(argv[i]) == "--local" && i + 1 < argc)
+        {
+            local_file = argv[++i];
+        }
+        else
+        {
+            config_file = argv[i];
+        }
+    }
+
+    Client client(config_file);
+    if (tune)
+    {
+        client.autotune(config_file);
+    }
+    else if (!local_file.empty())
+    {
+        client.run_local(local_file);
+    }
+    else
+    {
+        client.run();
+    }
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,484 @@
+#ifndef CORO_RUNTIME_HPP
+#define CORO_RUNTIME_HPP
+
+// Minimal C++20 coroutine runtime over epoll, so a few threads can drive
+// many logical clients. Each thread owns an EventLoop; coroutines return
+// Task<T>, await each other with co_await, and suspend on socket readiness
+// (loop.wait) or timers (loop.sleep) instead of blocking the thread.
+//
+// The socket helpers also work on blocking sockets, where they simply
+// block, and sync_wait() runs a task to completion on the calling thread.
+//
+// GCC 12 miscompiles some co_await expressions used directly as an if
+// condition (the awaited coroutine never starts); await into a local first.
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <string>
+#include <optional>
+#include <utility>
+#include <algorithm>
+#include <vector>
+#include <queue>
+#include <chrono>
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+class EventLoop;
+
+struct TaskPromiseBase
+{
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    std::exception_ptr exception;
+    size_t *finished = nullptr; // set for tasks spawned on a loop
+
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept
+        {
+            return false;
+        }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+        {
+            TaskPromiseBase &promise = handle.promise();
+            if (promise.finished != nullptr)
+            {
+                (*promise.finished)++;
+            }
+            return promise.continuation;
+        }
+
+        void await_resume() noexcept
+        {
+        }
+    };
+
+    std::suspend_always initial_suspend() noexcept
+    {
+        return {};
+    }
+
+    FinalAwaiter final_suspend() noexcept
+    {
+        return {};
+    }
+
+    void unhandled_exception()
+    {
+        exception = std::current_exception();
+    }
+};
+
+template <typename T>
+struct TaskPromise : TaskPromiseBase
+{
+    std::optional<T> value;
+
+    void return_value(T result)
+    {
+        value = std::move(result);
+    }
+
+    T take()
+    {
+        if (exception)
+        {
+            std::rethrow_exception(exception);
+        }
+        return std::move(*value);
+    }
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase
+{
+    void return_void()
+    {
+    }
+
+    void take()
+    {
+        if (exception)
+        {
+            std::rethrow_exception(exception);
+        }
+    }
+};
+
+// Lazily started: runs when first awaited (or spawned), and resumes its
+// awaiter when it finishes
+template <typename T = void>
+class Task
+{
+public:
+    struct promise_type : TaskPromise<T>
+    {
+        Task get_return_object()
+        {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+    };
+
+    Task(Task &&other) noexcept : handle(std::exchange(other.handle, {}))
+    {
+    }
+
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+
+    ~Task()
+    {
+        if (handle)
+        {
+            handle.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+
+    T await_resume()
+    {
+        return handle.promise().take();
+    }
+
+private:
+    friend class EventLoop;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle)
+    {
+    }
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+class EventLoop
+{
+private:
+    struct Timer
+    {
+        std::chrono::steady_clock::time_point when;
+        std::coroutine_handle<> handle;
+
+        bool operator>(const Timer &other) const
+        {
+            return when > other.when;
+        }
+    };
+
+    int epoll_fd;
+    std::vector<std::coroutine_handle<>> ready;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+    std::vector<Task<void>> tasks;
+    size_t finished = 0;
+
+public:
+    EventLoop() : epoll_fd(epoll_create1(EPOLL_CLOEXEC))
+    {
+    }
+
+    ~EventLoop()
+    {
+        close(epoll_fd);
+    }
+
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    // Starts on the next run()
+    void spawn(Task<void> task)
+    {
+        task.handle.promise().finished = &finished;
+        ready.push_back(task.handle);
+        tasks.push_back(std::move(task));
+    }
+
+    // Resumes coroutines until every spawned task has finished; rethrows the
+    // first exception a task ended with
+    void run()
+    {
+        std::vector<struct epoll_event> events(256);
+        while (finished < tasks.size())
+        {
+            while (!ready.empty())
+            {
+                std::vector<std::coroutine_handle<>> batch;
+                batch.swap(ready);
+                for (std::coroutine_handle<> handle : batch)
+                {
+                    handle.resume();
+                }
+            }
+            if (finished == tasks.size())
+            {
+                break;
+            }
+
+            int timeout_ms = -1;
+            if (!timers.empty())
+            {
+                auto wait = timers.top().when - std::chrono::steady_clock::now();
+                timeout_ms = std::max<long>(0, std::chrono::ceil<std::chrono::milliseconds>(wait).count());
+            }
+            int n = epoll_wait(epoll_fd, events.data(), events.size(), timeout_ms);
+            for (int i = 0; i < n; i++)
+            {
+                ready.push_back(std::coroutine_handle<>::from_address(events[i].data.ptr));
+            }
+            auto now = std::chrono::steady_clock::now();
+            while (!timers.empty() && timers.top().when <= now)
+            {
+                ready.push_back(timers.top().handle);
+                timers.pop();
+            }
+        }
+
+        for (Task<void> &task : tasks)
+        {
+            task.handle.promise().take();
+        }
+        tasks.clear();
+        finished = 0;
+    }
+
+    // co_await loop.wait(fd, EPOLLIN) resumes once fd is readable (or has
+    // an error or hangup pending, which the next read reports)
+    struct ReadinessAwaiter
+    {
+        EventLoop &loop;
+        int fd;
+        uint32_t events;
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            struct epoll_event event;
+            event.events = events | EPOLLONESHOT;
+            event.data.ptr = handle.address();
+            // A one-shot registration stays in the set disarmed; closing the
+            // fd removes it
+            if (epoll_ctl(loop.epoll_fd, EPOLL_CTL_MOD, fd, &event) < 0 &&
+                (errno != ENOENT || epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0))
+            {
+                loop.ready.push_back(handle);
+            }
+        }
+
+        void await_resume() const noexcept
+        {
+        }
+    };
+
+    ReadinessAwaiter wait(int fd, uint32_t events)
+    {
+        return {*this, fd, events};
+    }
+
+    struct TimerAwaiter
+    {
+        EventLoop &loop;
+        std::chrono::steady_clock::time_point when;
+
+        bool await_ready() const noexcept
+        {
+            return when <= std::chrono::steady_clock::now();
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            loop.timers.push({when, handle});
+        }
+
+        void await_resume() const noexcept
+        {
+        }
+    };
+
+    TimerAwaiter sleep(std::chrono::steady_clock::duration duration)
+    {
+        return {*this, std::chrono::steady_clock::now() + duration};
+    }
+};
+
+// Runs task, which may await loop, to completion on the calling thread
+template <typename T>
+T sync_wait(EventLoop &loop, Task<T> task)
+{
+    std::optional<T> result;
+    loop.spawn([](Task<T> task, std::optional<T> &result) -> Task<void>
+               { result = co_await task; }(std::move(task), result));
+    loop.run();
+    return std::move(*result);
+}
+
+// read(2) that suspends instead of failing with EAGAIN
+inline Task<ssize_t> async_read(EventLoop &loop, int fd, void *buffer, size_t size)
+{
+    while (true)
+    {
+        ssize_t n = read(fd, buffer, size);
+        if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        {
+            co_return n;
+        }
+        co_await loop.wait(fd, EPOLLIN);
+    }
+}
+
+// Sends all of data; false when the connection fails first
+inline Task<bool> async_send(EventLoop &loop, int fd, const char *data, size_t size)
+{
+    size_t sent = 0;
+    while (sent < size)
+    {
+        ssize_t n = send(fd, data + sent, size - sent, MSG_NOSIGNAL);
+        if (n > 0)
+        {
+            sent += n;
+        }
+        else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            co_await loop.wait(fd, EPOLLOUT);
+        }
+        else
+        {
+            co_return false;
+        }
+    }
+    co_return true;
+}
+
+// Newline-terminated lines from one connection. The receive buffer lives
+// as long as the reader, so a connection gets one reader, not a buffer per
+// line. co_await reader.read_line(line) completes without suspending, and
+// without a coroutine frame, when a line is already buffered; only then
+// does a frame read until one arrives. after_read, if set, runs after each
+// read(2) that returned data.
+class LineReader
+{
+public:
+    LineReader(EventLoop &loop, int fd, std::function<void()> after_read = nullptr)
+        : loop(loop), fd(fd), after_read(std::move(after_read))
+    {
+    }
+
+    struct LineAwaiter
+    {
+        LineReader &reader;
+        std::string &line;
+        std::optional<Task<bool>> refill;
+
+        bool await_ready()
+        {
+            return reader.take_line(line);
+        }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting)
+        {
+            refill.emplace(reader.read_until_line(line));
+            return refill->await_suspend(awaiting);
+        }
+
+        bool await_resume()
+        {
+            return !refill || refill->await_resume();
+        }
+    };
+
+    // False once the connection closes or fails before a whole line
+    LineAwaiter read_line(std::string &line)
+    {
+        return {*this, line, std::nullopt};
+    }
+
+private:
+    static const size_t READ_SIZE = 64 * 1024;
+
+    EventLoop &loop;
+    int fd;
+    std::function<void()> after_read;
+    std::string pending;
+    size_t start = 0; // first byte not yet returned as a line
+
+    bool take_line(std::string &line)
+    {
+        size_t newline = pending.find('\n', start);
+        if (newline == std::string::npos)
+        {
+            return false;
+        }
+        line.assign(pending, start, newline - start);
+        start = newline + 1;
+        return true;
+    }
+
+    Task<bool> read_until_line(std::string &line)
+    {
+        pending.erase(0, start);
+        start = 0;
+        // Nothing suspends between a read and its append, so every reader
+        // on the thread can share one buffer
+        static thread_local char buffer[READ_SIZE];
+        while (true)
+        {
+            size_t used = pending.size();
+            ssize_t n = read(fd, buffer, READ_SIZE);
+            if (n > 0)
+            {
+                pending.append(buffer, n);
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                co_await loop.wait(fd, EPOLLIN);
+                continue;
+            }
+            if (n <= 0)
+            {
+                co_return false;
+            }
+            if (after_read)
+            {
+                after_read();
+            }
+            if (pending.find('\n', used) != std::string::npos)
+            {
+                co_return take_line(line);
+            }
+        }
+    }
+};
+
+inline Task<bool> async_connect(EventLoop &loop, int fd, const struct sockaddr *address, socklen_t length)
+{
+    if (connect(fd, address, length) == 0)
+    {
+        co_return true;
+    }
+    if (errno != EINPROGRESS)
+    {
+        co_return false;
+    }
+    co_await loop.wait(fd, EPOLLOUT);
+    int error = 0;
+    socklen_t error_length = sizeof(error);
+    co_return getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_length) == 0 && error == 0;
+}
+
+#endif
@@ -0,0 +1,438 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <algorithm>
+#include <numeric>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+
+// Synthetic corpus generator: writes "word,word,...," files of a target size
+// in the same format as words.txt, with a Zipf-distributed vocabulary.
+//
+//   ./gencorpus --output corpus.txt --size 1G [--vocabulary 100000] [--zipf 1.0]
+//               [--lengths english|uniform] [--min-length 1] [--max-length 12]
+//               [--run-length 1.0] [--seed 1] [--reference expected.txt]
+//
+// Everything is derived from --seed with our own generator and samplers (not
+// <random> distributions, whose output differs between standard libraries),
+// and the Zipf weights use our own exp and log (libm's pow may round
+// differently), so the same arguments give the same bytes on every machine. Rank 1 is the
+// most frequent word; vocabulary words are assigned to ranks shortest first,
+// as in natural language. --run-length is the mean length of runs of one
+// word repeated back to back (geometric, 1 = no repetition). --reference
+// writes the expected client output ("word, count" in sorted order).
+
+// xoshiro256**, seeded through splitmix64
+class Rng
+{
+private:
+    uint64_t state[4];
+
+    static uint64_t rotl(uint64_t x, int k)
+    {
+        return (x << k) | (x >> (64 - k));
+    }
+
+public:
+    explicit Rng(uint64_t seed)
+    {
+        for (uint64_t &word : state)
+        {
+            seed += 0x9e3779b97f4a7c15ULL;
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            word = z ^ (z >> 31);
+        }
+    }
+
+    uint64_t next()
+    {
+        uint64_t result = rotl(state[1] * 5, 7) * 9;
+        uint64_t t = state[1] << 17;
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= t;
+        state[3] = rotl(state[3], 45);
+        return result;
+    }
+
+    // Uniform in [0, 1)
+    double uniform()
+    {
+        return (next() >> 11) * 0x1.0p-53;
+    }
+
+    uint64_t below(uint64_t bound)
+    {
+        return (uint64_t)(uniform() * bound);
+    }
+};
+
+// Walker/Vose alias table: O(1) sampling from any discrete distribution
+class AliasSampler
+{
+private:
+    std::vector<double> probability;
+    std::vector<uint32_t> alias;
+
+public:
+    explicit AliasSampler(const std::vector<double> &weights)
+    {
+        size_t n = weights.size();
+        double total = std::accumulate(weights.begin(), weights.end(), 0.0);
+        probability.resize(n);
+        alias.resize(n);
+        std::vector<double> scaled(n);
+        std::vector<uint32_t> small, large;
+        for (size_t i = 0; i < n; i++)
+        {
+            scaled[i] = weights[i] * n / total;
+            (scaled[i] < 1.0 ? small : large).push_back(i);
+        }
+        while (!small.empty() && !large.empty())
+        {
+            uint32_t s = small.back(), l = large.back();
+            small.pop_back();
+            probability[s] = scaled[s];
+            alias[s] = l;
+            scaled[l] -= 1.0 - scaled[s];
+            if (scaled[l] < 1.0)
+            {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        for (uint32_t i : large)
+        {
+            probability[i] = 1.0;
+        }
+        for (uint32_t i : small)
+        {
+            probability[i] = 1.0;
+        }
+    }
+
+    uint32_t sample(Rng &rng) const
+    {
+        uint32_t column = rng.below(probability.size());
+        return rng.uniform() < probability[column] ? column : alias[column];
+    }
+};
+
+// exp and log from +, -, * and / alone, which IEEE 754 rounds the same way
+// everywhere; within about 1e-14 of libm, which is plenty for weights
+static double portable_log(double x)
+{
+    // x = m * 2^e with m in [sqrt(1/2), sqrt(2)); then ln m = 2 atanh((m - 1) / (m + 1))
+    int e = 0;
+    while (x >= 1.4142135623730951)
+    {
+        x *= 0.5;
+        e++;
+    }
+    while (x < 0.7071067811865476)
+    {
+        x *= 2;
+        e--;
+    }
+    double t = (x - 1) / (x + 1), t2 = t * t, term = t, sum = 0;
+    for (int i = 1; i < 60; i += 2)
+    {
+        sum += term / i;
+        term *= t2;
+    }
+    return 2 * sum + e * 0.6931471805599453;
+}
+
+static double portable_exp(double y)
+{
+    // y = k ln 2 + r with |r| <= ln 2 / 2; then e^y = 2^k e^r
+    const double ln2 = 0.6931471805599453;
+    double k = y / ln2;
+    k = k < 0 ? (double)(int64_t)(k - 0.5) : (double)(int64_t)(k + 0.5);
+    double r = y - k * ln2, term = 1, sum = 1;
+    for (int i = 1; i < 25; i++)
+    {
+        term *= r / i;
+        sum += term;
+    }
+    for (; k > 0; k--)
+    {
+        sum *= 2;
+    }
+    for (; k < 0; k++)
+    {
+        sum *= 0.5;
+    }
+    return sum;
+}
+
+static uint64_t parse_size(const std::string &text)
+{
+    size_t end;
+    double value = std::stod(text, &end);
+    std::string suffix = text.substr(end);
+    double scale = 1;
+    if (suffix == "K" || suffix == "k")
+    {
+        scale = 1ULL << 10;
+    }
+    else if (suffix == "M" || suffix == "m")
+    {
+        scale = 1ULL << 20;
+    }
+    else if (suffix == "G" || suffix == "g")
+    {
+        scale = 1ULL << 30;
+    }
+    else if (!suffix.empty())
+    {
+        throw std::invalid_argument("size suffix must be K, M or G");
+    }
+    return (uint64_t)(value * scale);
+}
+
+// Lowercase words of min_length to max_length letters, capped well past
+// any vocabulary that fits in a uint32_t
+static uint64_t vocabulary_capacity(int min_length, int max_length)
+{
+    uint64_t capacity = 0, words = 1;
+    for (int length = 1; length <= max_length && capacity <= UINT32_MAX; length++)
+    {
+        words = std::min<uint64_t>(words * 26, uint64_t(1) << 40);
+        if (length >= min_length)
+        {
+            capacity += words;
+        }
+    }
+    return capacity;
+}
+
+// Distinct lowercase words with lengths drawn from the chosen distribution.
+// A drawn word already taken moves on to the next unused word of the same
+// length; a length with no unused words left is drawn again.
+// The caller checks the lengths hold enough words.
+static std::vector<std::string> build_vocabulary(size_t size, const std::string &lengths, int min_length, int max_length,
+                                                 Rng &rng)
+{
+    // Relative frequency of English dictionary word lengths 1..15
+    static const double english[] = {0.1, 0.6, 2.6, 5.2, 8.5, 12.2, 14.0, 14.0, 12.6, 10.1, 7.5, 5.2, 3.2, 2.0, 1.0};
+
+    std::vector<double> length_weights;
+    for (int length = min_length; length <= max_length; length++)
+    {
+        length_weights.push_back(lengths == "uniform" ? 1.0 : length <= 15 ? english[length - 1]
+                                                                           : 0.5);
+    }
+    AliasSampler length_sampler(length_weights);
+    std::vector<uint64_t> unused;
+    for (int length = min_length; length <= max_length; length++)
+    {
+        unused.push_back(vocabulary_capacity(length, length));
+    }
+
+    std::vector<std::string> vocabulary;
+    std::unordered_set<std::string> seen;
+    vocabulary.reserve(size);
+    while (vocabulary.size() < size)
+    {
+        size_t index = length_sampler.sample(rng);
+        if (unused[index] == 0)
+        {
+            continue;
+        }
+        unused[index]--;
+        std::string word;
+        for (int i = 0; i < min_length + (int)index; i++)
+        {
+            word += (char)('a' + rng.below(26));
+        }
+        while (!seen.insert(word).second)
+        {
+            // Next word of this length, wrapping from "zz..z" to "aa..a"
+            size_t i = word.size();
+            while (i > 0 && word[i - 1] == 'z')
+            {
+                word[--i] = 'a';
+            }
+            if (i > 0)
+            {
+                word[i - 1]++;
+            }
+        }
+        vocabulary.push_back(word);
+    }
+
+    std::stable_sort(vocabulary.begin(), vocabulary.end(), [](const std::string &a, const std::string &b)
+                     { return a.size() < b.size(); });
+    return vocabulary;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string output, reference, lengths = "english";
+    uint64_t target_size = 1 << 20;
+    size_t vocabulary_size = 100000;
+    double exponent = 1.0, run_length = 1.0;
+    int min_length = 1, max_length = 12;
+    uint64_t seed = 1;
+
+    try
+    {
+        for (int i = 1; i < argc; i += 2)
+        {
+            std::string key = argv[i];
+            if (i + 1 >= argc)
+            {
+                throw std::invalid_argument("missing value for " + key);
+            }
+            std::string value = argv[i + 1];
+            if (key == "--output")
+            {
+                output = value;
+            }
+            else if (key == "--size")
+            {
+                target_size = parse_size(value);
+            }
+            else if (key == "--vocabulary")
+            {
+                vocabulary_size = std::stoull(value);
+            }
+            else if (key == "--zipf")
+            {
+                exponent = std::stod(value);
+            }
+            else if (key == "--lengths")
+            {
+                lengths = value;
+            }
+            else if (key == "--min-length")
+            {
+                min_length = std::stoi(value);
+            }
+            else if (key == "--max-length")
+            {
+                max_length = std::stoi(value);
+            }
+            else if (key == "--run-length")
+            {
+                run_length = std::stod(value);
+            }
+            else if (key == "--seed")
+            {
+                seed = std::stoull(value);
+            }
+            else if (key == "--reference")
+            {
+                reference = value;
+            }
+            else
+            {
+                throw std::invalid_argument("unknown option " + key);
+            }
+        }
+        if (output.empty() || vocabulary_size == 0 || vocabulary_size > UINT32_MAX || exponent < 0 || run_length < 1 ||
+            min_length < 1 || max_length < min_length || (lengths != "english" && lengths != "uniform"))
+        {
+            throw std::invalid_argument("invalid arguments");
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "gencorpus: " << e.what() << "\n"
+                  << "Usage: ./gencorpus --output file --size 1G [--vocabulary N] [--zipf S]\n"
+                     "                   [--lengths english|uniform] [--min-length N] [--max-length N]\n"
+                     "                   [--run-length MEAN] [--seed N] [--reference file]"
+                  << std::endl;
+        return 1;
+    }
+
+    if (vocabulary_size > vocabulary_capacity(min_length, max_length))
+    {
+        std::cerr << "gencorpus: only " << vocabulary_capacity(min_length, max_length) << " distinct words have "
+                  << min_length << " to " << max_length << " letters; lower --vocabulary or raise --max-length"
+                  << std::endl;
+        return 1;
+    }
+
+    Rng rng(seed);
+    std::vector<std::string> vocabulary = build_vocabulary(vocabulary_size, lengths, min_length, max_length, rng);
+
+    std::vector<double> rank_weights(vocabulary_size);
+    for (size_t rank = 0; rank < vocabulary_size; rank++)
+    {
+        rank_weights[rank] = portable_exp(-exponent * portable_log((double)(rank + 1)));
+    }
+    AliasSampler rank_sampler(rank_weights);
+
+    FILE *out = fopen(output.c_str(), "wb");
+    if (out == nullptr)
+    {
+        std::cerr << "Failed to open file: " << output << std::endl;
+        return 1;
+    }
+
+    // Geometric run lengths with the requested mean
+    double repeat = 1.0 - 1.0 / run_length;
+    std::vector<uint64_t> counts(vocabulary_size, 0);
+    std::string buffer;
+    buffer.reserve(1 << 20);
+    uint64_t written = 0, words = 0;
+    while (written < target_size)
+    {
+        uint32_t rank = rank_sampler.sample(rng);
+        const std::string &word = vocabulary[rank];
+        do
+        {
+            buffer += word;
+            buffer += ',';
+            written += word.size() + 1;
+            counts[rank]++;
+            words++;
+        } while (written < target_size && rng.uniform() < repeat);
+
+        if (buffer.size() >= (1 << 20) - 64)
+        {
+            fwrite(buffer.data(), 1, buffer.size(), out);
+            buffer.clear();
+        }
+    }
+    fwrite(buffer.data(), 1, buffer.size(), out);
+    if (fclose(out) != 0)
+    {
+        std::cerr << "Failed to write file: " << output << std::endl;
+        return 1;
+    }
+
+    size_t distinct = std::count_if(counts.begin(), counts.end(), [](uint64_t count)
+                                    { return count > 0; });
+    if (!reference.empty())
+    {
+        std::vector<uint32_t> order;
+        for (size_t rank = 0; rank < vocabulary_size; rank++)
+        {
+            if (counts[rank] > 0)
+            {
+                order.push_back(rank);
+            }
+        }
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+                  { return vocabulary[a] < vocabulary[b]; });
+        std::ofstream reference_out(reference);
+        for (uint32_t rank : order)
+        {
+            reference_out << vocabulary[rank] << ", " << counts[rank] << "\n";
+        }
+    }
+
+    std::cout << "Wrote " << words << " words (" << written << " bytes, " << distinct << " distinct) to " << output
+              << std::endl;
+    return 0;
+}
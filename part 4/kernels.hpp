@@ -0,0 +1,264 @@
+#ifndef KERNELS_HPP
+#define KERNELS_HPP
+
+// The tokenize / packetize / parse / count / output kernels shared by the
+// server, the client and the microbenchmarks in bench.cpp.
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <ostream>
+#include <istream>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
+
+// Corpus tokenization with std::getline(file, word, ',') semantics: a
+// trailing comma does not produce an empty last word.
+template <typename Callback>
+void for_each_corpus_word(const char *data, size_t size, Callback &&callback)
+{
+    const char *cursor = data;
+    const char *end = data + size;
+    while (cursor < end)
+    {
+        const char *comma = (const char *)memchr(cursor, ',', end - cursor);
+        if (comma == nullptr)
+        {
+            callback(std::string_view(cursor, end - cursor));
+            return;
+        }
+        callback(std::string_view(cursor, comma - cursor));
+        cursor = comma + 1;
+    }
+}
+
+inline void tokenize_corpus(std::istream &file, std::vector<std::string> &words)
+{
+    std::string data;
+    file.seekg(0, std::ios::end);
+    std::streamoff size = file.tellg();
+    file.seekg(0, std::ios::beg);
+    if (size > 0)
+    {
+        data.resize(size);
+        file.read(&data[0], size);
+        data.resize(file.gcount());
+    }
+    else
+    {
+        file.clear();
+        data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    words.reserve(words.size() + std::count(data.begin(), data.end(), ',') + 1);
+    for_each_corpus_word(data.data(), data.size(), [&](std::string_view word)
+                         { words.emplace_back(word); });
+}
+
+// Wire packets split exactly: n commas always give n + 1 words, so empty
+// words are counted like any other.
+template <typename Callback>
+void for_each_field(std::string_view line, Callback &&callback)
+{
+    const char *cursor = line.data();
+    const char *end = cursor + line.size();
+    while (true)
+    {
+        const char *comma = (const char *)memchr(cursor, ',', end - cursor);
+        if (comma == nullptr)
+        {
+            callback(std::string_view(cursor, end - cursor));
+            return;
+        }
+        callback(std::string_view(cursor, comma - cursor));
+        cursor = comma + 1;
+    }
+}
+
+// Packetization of a framed window: count words from offset in packets of
+// p words, one line per packet. packet_ends marks where each packet stops.
+inline void render_window(const std::vector<std::string> &words, size_t offset, size_t count, size_t p,
+                          std::string &out, std::vector<size_t> &packet_ends)
+{
+    for (size_t i = 0; i < count; i += p)
+    {
+        for (size_t j = i; j < count && j < i + p; j++)
+        {
+            out += words[offset + j];
+            out += j + 1 < count && j + 1 < i + p ? ',' : '\n';
+        }
+        packet_ends.push_back(out.size());
+    }
+}
+
+template <typename Table>
+void write_frequency_text(std::ostream &out, const Table &frequency)
+{
+    for (const auto &pair : frequency)
+    {
+        out << pair.first << ", " << pair.second << "\n";
+    }
+}
+
+inline uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+inline uint64_t hash_bytes(const char *data, size_t length)
+{
+    uint64_t hash = 0x9e3779b97f4a7c15ULL ^ (length * 0xff51afd7ed558ccdULL);
+    while (length >= 8)
+    {
+        uint64_t chunk;
+        memcpy(&chunk, data, 8);
+        hash = (hash ^ mix64(chunk)) * 0x9e3779b97f4a7c15ULL;
+        data += 8;
+        length -= 8;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, data, length);
+    return mix64(hash ^ tail ^ (length << 56));
+}
+
+inline uint64_t hash_word(std::string_view word)
+{
+    return hash_bytes(word.data(), word.size());
+}
+
+// Open-addressing word -> count table. Keys live in one arena, slots keep
+// the full hash, so lookups compare hashes before touching key bytes and
+// growing never rehashes strings.
+class WordCountTable
+{
+private:
+    struct Slot
+    {
+        uint64_t hash;
+        uint64_t key_offset;
+        uint64_t count; // 0: empty
+        uint32_t key_length;
+    };
+
+    std::vector<Slot> slots;
+    std::string arena;
+    size_t used = 0;
+
+    size_t probe(uint64_t hash, std::string_view word) const
+    {
+        size_t mask = slots.size() - 1;
+        size_t i = hash & mask;
+        while (slots[i].count != 0 &&
+               (slots[i].hash != hash || slots[i].key_length != word.size() ||
+                memcmp(arena.data() + slots[i].key_offset, word.data(), word.size()) != 0))
+        {
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+
+    void grow()
+    {
+        std::vector<Slot> old;
+        old.swap(slots);
+        slots.assign(old.empty() ? 64 : old.size() * 2, Slot{0, 0, 0, 0});
+        size_t mask = slots.size() - 1;
+        for (const Slot &slot : old)
+        {
+            if (slot.count == 0)
+            {
+                continue;
+            }
+            size_t i = slot.hash & mask;
+            while (slots[i].count != 0)
+            {
+                i = (i + 1) & mask;
+            }
+            slots[i] = slot;
+        }
+    }
+
+public:
+    WordCountTable()
+    {
+        grow();
+    }
+
+    void add(std::string_view word, uint64_t count = 1)
+    {
+        add_hashed(hash_word(word), word, count);
+    }
+
+    void add_hashed(uint64_t hash, std::string_view word, uint64_t count = 1)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+        if ((used + 1) * 4 > slots.size() * 3)
+        {
+            grow();
+        }
+        size_t i = probe(hash, word);
+        if (slots[i].count == 0)
+        {
+            slots[i].hash = hash;
+            slots[i].key_offset = arena.size();
+            slots[i].key_length = word.size();
+            arena.append(word.data(), word.size());
+            used++;
+        }
+        slots[i].count += count;
+    }
+
+    uint64_t find(std::string_view word) const
+    {
+        return slots[probe(hash_word(word), word)].count;
+    }
+
+    void merge(const WordCountTable &other)
+    {
+        other.for_each([&](std::string_view word, uint64_t count)
+                       { add(word, count); });
+    }
+
+    size_t size() const
+    {
+        return used;
+    }
+
+    bool empty() const
+    {
+        return used == 0;
+    }
+
+    void clear()
+    {
+        slots.clear();
+        arena.clear();
+        used = 0;
+        grow();
+    }
+
+    template <typename Callback>
+    void for_each(Callback &&callback) const
+    {
+        for (const Slot &slot : slots)
+        {
+            if (slot.count != 0)
+            {
+                callback(std::string_view(arena.data() + slot.key_offset, slot.key_length), slot.count);
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,692 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <queue>
+#include <random>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <iterator>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include "json.hpp"
+#include "stats.hpp"
+#include "kernels.hpp"
+#include "socket_tuning.hpp"
+
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+// Load generator: many logical clients multiplexed over a few epoll threads.
+// Sessions arrive open loop (poisson or constant rate, on a schedule that does
+// not wait for earlier sessions) or closed loop (all at once, like ./client).
+// Each session connects, fetches windows until the corpus ends or --windows is
+// reached, optionally thinking between windows, and disconnects.
+//
+//   ./loadgen [--config config_4.json] [--clients 1000] [--threads 4]
+//             [--arrival poisson|constant|closed] [--rate 500] [--windows 0]
+//             [--think-ms 0] [--protocol framed|legacy] [--k K] [--p P]
+//             [--rcvbuf BYTES] [--seed 1] [--timeout 60] [--json loadgen.json]
+//             [--csv loadgen.csv]
+//
+// The config's socket_profile applies to loadgen's sockets too.
+// --k/--p are written into the config file; a part 4 server picks them up
+// live. The file's original bytes are put back when loadgen exits, also on
+// SIGINT or SIGTERM. The legacy protocol needs k to find window ends and also works
+// against the part 2 server.
+
+struct LoadgenOptions
+{
+    std::string config_file = "config_4.json";
+    std::string server_ip;
+    int server_port;
+    int k;
+    int clients = 1000;
+    int threads = 4;
+    std::string arrival = "poisson";
+    double rate = 500;
+    int windows = 0; // 0: whole corpus
+    double think_ms = 0;
+    std::string protocol = "framed";
+    uint64_t seed = 1;
+    double timeout = 60;
+    int rcvbuf = 0; // 0: kernel default, overrides the profile's
+    SocketProfile socket_profile;
+    std::string json_file = "loadgen.json";
+    std::string csv_file = "loadgen.csv";
+};
+
+enum SessionState
+{
+    WAITING,
+    CONNECTING,
+    AWAITING_WINDOW,
+    THINKING,
+    FINISHED
+};
+
+struct Session
+{
+    int id;
+    double arrival; // seconds after the run started
+    SessionState state = WAITING;
+    int fd = -1;
+    int offset = 0;
+    std::string pending;
+
+    // Current window
+    bool header_seen = false;
+    int expected = 0;
+    int received = 0;
+    int remaining = 0;
+    bool eof = false;
+    Clock::time_point window_sent;
+
+    int windows = 0;
+    uint64_t words = 0;
+    uint64_t bytes = 0;
+    double connected = 0; // seconds after the run started
+    double completed = 0;
+    bool failed = false;
+};
+
+class Worker
+{
+private:
+    const LoadgenOptions &options;
+    Clock::time_point run_start;
+    std::vector<Session *> sessions;
+    struct sockaddr_in server_address;
+    int epoll_fd;
+    int finished = 0;
+
+    typedef std::pair<Clock::time_point, Session *> Timer;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+
+public:
+    LatencyHistogram window_latency;
+    LatencyHistogram connect_latency;
+    uint64_t window_count = 0;
+    pthread_t thread;
+
+    Worker(const LoadgenOptions &options, Clock::time_point run_start) : options(options), run_start(run_start)
+    {
+        memset(&server_address, 0, sizeof(server_address));
+        server_address.sin_family = AF_INET;
+        server_address.sin_port = htons(options.server_port);
+        inet_pton(AF_INET, options.server_ip.c_str(), &server_address.sin_addr);
+        epoll_fd = epoll_create1(0);
+    }
+
+    ~Worker()
+    {
+        close(epoll_fd);
+    }
+
+    void add(Session *session)
+    {
+        sessions.push_back(session);
+        timers.push({run_start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(session->arrival)),
+                     session});
+    }
+
+    double since_start(Clock::time_point time) const
+    {
+        return std::chrono::duration<double>(time - run_start).count();
+    }
+
+    void finish(Session *session, bool failed)
+    {
+        if (session->fd >= 0)
+        {
+            close(session->fd);
+            session->fd = -1;
+        }
+        session->failed = failed;
+        session->completed = since_start(Clock::now());
+        session->state = FINISHED;
+        finished++;
+    }
+
+    void start_connect(Session *session)
+    {
+        session->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (session->fd < 0)
+        {
+            finish(session, true);
+            return;
+        }
+        apply_socket_profile(session->fd, options.socket_profile);
+        if (options.rcvbuf > 0)
+        {
+            setsockopt(session->fd, SOL_SOCKET, SO_RCVBUF, &options.rcvbuf, sizeof(options.rcvbuf));
+        }
+        session->window_sent = Clock::now();
+        int rc = connect(session->fd, (struct sockaddr *)&server_address, sizeof(server_address));
+        if (rc < 0 && errno != EINPROGRESS)
+        {
+            finish(session, true);
+            return;
+        }
+        session->state = CONNECTING;
+        struct epoll_event event;
+        event.events = EPOLLOUT;
+        event.data.ptr = session;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, session->fd, &event);
+    }
+
+    void connected(Session *session)
+    {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(session->fd, SOL_SOCKET, SO_ERROR, &error, &length);
+        if (error != 0)
+        {
+            finish(session, true);
+            return;
+        }
+        connect_latency.record(elapsed_ns(session->window_sent));
+        session->connected = since_start(Clock::now());
+
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = session;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, session->fd, &event);
+        send_request(session);
+    }
+
+    void send_request(Session *session)
+    {
+        std::string message = options.protocol == "framed" ? "GET " + std::to_string(session->offset) + "\n"
+                                                           : std::to_string(session->offset) + "\n";
+        session->header_seen = options.protocol != "framed";
+        session->expected = options.k;
+        session->received = 0;
+        session->eof = false;
+        session->state = AWAITING_WINDOW;
+        session->window_sent = Clock::now();
+        if (send(session->fd, message.c_str(), message.length(), MSG_NOSIGNAL) != (ssize_t)message.length())
+        {
+            finish(session, true);
+        }
+    }
+
+    void window_done(Session *session)
+    {
+        window_latency.record(elapsed_ns(session->window_sent));
+        window_count++;
+        session->windows++;
+        session->offset += session->received;
+        bool last = options.protocol == "framed" ? session->remaining == 0 : session->eof;
+        if (last || (options.windows > 0 && session->windows >= options.windows))
+        {
+            finish(session, false);
+        }
+        else if (options.think_ms > 0)
+        {
+            session->state = THINKING;
+            timers.push({Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                                            std::chrono::duration<double, std::milli>(options.think_ms)),
+                         session});
+        }
+        else
+        {
+            send_request(session);
+        }
+    }
+
+    // Returns false once the session is finished
+    bool handle_line(Session *session, std::string_view line)
+    {
+        if (line == "$$")
+        {
+            finish(session, false);
+            return false;
+        }
+        if (!session->header_seen)
+        {
+            int win_offset, count, remaining;
+            if (sscanf(std::string(line).c_str(), "WIN %d %d %d", &win_offset, &count, &remaining) != 3)
+            {
+                finish(session, true);
+                return false;
+            }
+            session->header_seen = true;
+            session->offset = win_offset;
+            session->expected = count;
+            session->remaining = remaining;
+            return true;
+        }
+
+        bool legacy = options.protocol != "framed";
+        for_each_field(line, [&](std::string_view word)
+                       {
+            if (legacy && word == "EOF")
+            {
+                session->eof = true;
+                return;
+            }
+            session->received++; });
+        if (session->received >= session->expected || session->eof)
+        {
+            session->words += session->received;
+            window_done(session);
+            return session->state != FINISHED;
+        }
+        return true;
+    }
+
+    void readable(Session *session)
+    {
+        char buffer[65536];
+        while (session->state == AWAITING_WINDOW)
+        {
+            ssize_t valread = read(session->fd, buffer, sizeof(buffer));
+            if (valread == 0 || (valread < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+            {
+                finish(session, true);
+                return;
+            }
+            if (valread < 0)
+            {
+                return;
+            }
+            rearm_quickack(session->fd, options.socket_profile);
+            session->bytes += valread;
+            session->pending.append(buffer, valread);
+
+            size_t start = 0, newline;
+            while (session->state == AWAITING_WINDOW &&
+                   (newline = session->pending.find('\n', start)) != std::string::npos)
+            {
+                std::string_view line(session->pending.data() + start, newline - start);
+                start = newline + 1;
+                if (!handle_line(session, line))
+                {
+                    break;
+                }
+            }
+            session->pending.erase(0, start);
+        }
+    }
+
+    void run()
+    {
+        struct epoll_event events[256];
+        Clock::time_point deadline =
+            run_start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.timeout));
+
+        while (finished < (int)sessions.size())
+        {
+            Clock::time_point now = Clock::now();
+            if (now >= deadline)
+            {
+                for (Session *session : sessions)
+                {
+                    if (session->state != FINISHED)
+                    {
+                        finish(session, true);
+                    }
+                }
+                break;
+            }
+
+            while (!timers.empty() && timers.top().first <= now)
+            {
+                Session *session = timers.top().second;
+                timers.pop();
+                if (session->state == WAITING)
+                {
+                    start_connect(session);
+                }
+                else if (session->state == THINKING)
+                {
+                    send_request(session);
+                }
+            }
+
+            Clock::time_point wake = timers.empty() ? deadline : std::min(deadline, timers.top().first);
+            int timeout_ms = (int)std::chrono::ceil<std::chrono::milliseconds>(wake - Clock::now()).count();
+            int ready = epoll_wait(epoll_fd, events, 256, std::max(0, timeout_ms));
+            for (int i = 0; i < ready; i++)
+            {
+                Session *session = (Session *)events[i].data.ptr;
+                if (session->state == CONNECTING)
+                {
+                    connected(session);
+                }
+                else if (session->state == AWAITING_WINDOW)
+                {
+                    readable(session);
+                }
+                else if (session->state == THINKING && (events[i].events & (EPOLLHUP | EPOLLERR)))
+                {
+                    finish(session, true);
+                }
+            }
+        }
+    }
+};
+
+// The config file as it was before --k/--p rewrote it
+static std::string saved_config_path;
+static std::string saved_config_bytes;
+
+// Only open/write/close, so it is also safe in a signal handler
+static void restore_config()
+{
+    if (saved_config_path.empty())
+    {
+        return;
+    }
+    int fd = open(saved_config_path.c_str(), O_WRONLY | O_TRUNC);
+    if (fd < 0)
+    {
+        return;
+    }
+    size_t written = 0;
+    while (written < saved_config_bytes.size())
+    {
+        ssize_t n = write(fd, saved_config_bytes.data() + written, saved_config_bytes.size() - written);
+        if (n <= 0)
+        {
+            break;
+        }
+        written += n;
+    }
+    close(fd);
+}
+
+static void restore_config_and_exit(int signal_number)
+{
+    restore_config();
+    signal(signal_number, SIG_DFL);
+    raise(signal_number);
+}
+
+static void print_usage()
+{
+    std::cerr << "Usage: ./loadgen [--config file] [--clients N] [--threads T] [--arrival poisson|constant|closed]\n"
+                 "                 [--rate R] [--windows W] [--think-ms MS] [--protocol framed|legacy] [--k K] [--p P]\n"
+                 "                 [--rcvbuf BYTES] [--seed S] [--timeout SECONDS] [--json file] [--csv file]"
+              << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    LoadgenOptions options;
+    int k_override = -1, p_override = -1;
+    for (int i = 1; i < argc; i += 2)
+    {
+        std::string key = argv[i];
+        if (i + 1 >= argc)
+        {
+            print_usage();
+            return 1;
+        }
+        std::string value = argv[i + 1];
+        if (key == "--config")
+        {
+            options.config_file = value;
+        }
+        else if (key == "--clients")
+        {
+            options.clients = std::stoi(value);
+        }
+        else if (key == "--threads")
+        {
+            options.threads = std::stoi(value);
+        }
+        else if (key == "--arrival")
+        {
+            options.arrival = value;
+        }
+        else if (key == "--rate")
+        {
+            options.rate = std::stod(value);
+        }
+        else if (key == "--windows")
+        {
+            options.windows = std::stoi(value);
+        }
+        else if (key == "--think-ms")
+        {
+            options.think_ms = std::stod(value);
+        }
+        else if (key == "--protocol")
+        {
+            options.protocol = value;
+        }
+        else if (key == "--k")
+        {
+            k_override = std::stoi(value);
+        }
+        else if (key == "--p")
+        {
+            p_override = std::stoi(value);
+        }
+        else if (key == "--rcvbuf")
+        {
+            options.rcvbuf = std::stoi(value);
+        }
+        else if (key == "--seed")
+        {
+            options.seed = std::stoull(value);
+        }
+        else if (key == "--timeout")
+        {
+            options.timeout = std::stod(value);
+        }
+        else if (key == "--json")
+        {
+            options.json_file = value;
+        }
+        else if (key == "--csv")
+        {
+            options.csv_file = value;
+        }
+        else
+        {
+            print_usage();
+            return 1;
+        }
+    }
+    if ((options.arrival != "poisson" && options.arrival != "constant" && options.arrival != "closed") ||
+        (options.protocol != "framed" && options.protocol != "legacy") || options.clients <= 0 ||
+        options.threads <= 0 || (options.arrival != "closed" && options.rate <= 0))
+    {
+        print_usage();
+        return 1;
+    }
+
+    std::ifstream config_stream(options.config_file);
+    if (!config_stream.is_open())
+    {
+        std::cerr << "Failed to open config file: " << options.config_file << std::endl;
+        return 1;
+    }
+    std::string config_bytes((std::istreambuf_iterator<char>(config_stream)), std::istreambuf_iterator<char>());
+    config_stream.close();
+    json config = json::parse(config_bytes);
+    if (k_override > 0 || p_override > 0)
+    {
+        saved_config_path = options.config_file;
+        saved_config_bytes = config_bytes;
+        std::atexit(restore_config);
+        signal(SIGINT, restore_config_and_exit);
+        signal(SIGTERM, restore_config_and_exit);
+
+        if (k_override > 0)
+        {
+            config["k"] = k_override;
+        }
+        if (p_override > 0)
+        {
+            config["p"] = p_override;
+        }
+        std::ofstream out(options.config_file);
+        out << config.dump(4) << std::endl;
+        out.close();
+        // The server polls the config file every 250 ms
+        usleep(600000);
+    }
+    options.server_ip = config["server_ip"];
+    options.server_port = config["server_port"];
+    options.k = config["k"];
+    try
+    {
+        options.socket_profile = SocketProfile::from_json(config);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Invalid socket settings: " << e.what() << std::endl;
+        return 1;
+    }
+
+    // Every concurrent session holds a descriptor
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<Session> sessions(options.clients);
+    std::mt19937_64 rng(options.seed);
+    std::exponential_distribution<double> interarrival(options.arrival == "closed" ? 1.0 : options.rate);
+    double arrival = 0;
+    for (int i = 0; i < options.clients; i++)
+    {
+        sessions[i].id = i;
+        if (options.arrival == "poisson")
+        {
+            arrival += interarrival(rng);
+        }
+        else if (options.arrival == "constant")
+        {
+            arrival = i / options.rate;
+        }
+        sessions[i].arrival = arrival;
+    }
+
+    Clock::time_point run_start = Clock::now() + std::chrono::milliseconds(10);
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (int t = 0; t < options.threads; t++)
+    {
+        workers.push_back(std::make_unique<Worker>(options, run_start));
+    }
+    for (int i = 0; i < options.clients; i++)
+    {
+        workers[i % options.threads]->add(&sessions[i]);
+    }
+    for (auto &worker : workers)
+    {
+        pthread_create(&worker->thread, NULL, [](void *arg) -> void *
+                       {
+            static_cast<Worker*>(arg)->run();
+            return NULL; }, worker.get());
+    }
+
+    std::vector<uint64_t> window_latency, connect_latency;
+    uint64_t window_count = 0;
+    for (auto &worker : workers)
+    {
+        pthread_join(worker->thread, NULL);
+        worker->window_latency.merge_into(window_latency);
+        worker->connect_latency.merge_into(connect_latency);
+        window_count += worker->window_count;
+    }
+
+    // Completion time runs from the scheduled arrival, so time spent waiting
+    // for an overloaded server to accept counts against it.
+    double wall = 0, total_completion = 0;
+    int completed = 0, failed = 0;
+    uint64_t words = 0, bytes = 0;
+    std::vector<double> completions;
+    for (const Session &session : sessions)
+    {
+        wall = std::max(wall, session.completed);
+        words += session.words;
+        bytes += session.bytes;
+        if (session.failed)
+        {
+            failed++;
+            continue;
+        }
+        completed++;
+        completions.push_back(session.completed - session.arrival);
+        total_completion += session.completed - session.arrival;
+    }
+    std::sort(completions.begin(), completions.end());
+    auto completion_quantile = [&](double q)
+    {
+        return completions.empty() ? 0.0 : completions[std::min(completions.size() - 1, (size_t)(q * completions.size()))];
+    };
+    double average_completion = completed > 0 ? total_completion / completed : 0;
+
+    json report = {
+        {"options",
+         {{"clients", options.clients},
+          {"threads", options.threads},
+          {"arrival", options.arrival},
+          {"rate", options.rate},
+          {"windows", options.windows},
+          {"think_ms", options.think_ms},
+          {"protocol", options.protocol},
+          {"k", config["k"]},
+          {"p", config["p"]},
+          {"rcvbuf", options.rcvbuf},
+          {"socket_profile", options.socket_profile.name},
+          {"seed", options.seed}}},
+        {"sessions", {{"completed", completed}, {"failed", failed}}},
+        {"wall_seconds", wall},
+        {"completion_seconds",
+         {{"mean", average_completion},
+          {"p50", completion_quantile(0.5)},
+          {"p99", completion_quantile(0.99)},
+          {"max", completions.empty() ? 0.0 : completions.back()}}},
+        {"window_latency_seconds",
+         {{"count", window_count},
+          {"p50", LatencyHistogram::percentile(window_latency, 0.5) / 1e9},
+          {"p90", LatencyHistogram::percentile(window_latency, 0.9) / 1e9},
+          {"p99", LatencyHistogram::percentile(window_latency, 0.99) / 1e9},
+          {"p999", LatencyHistogram::percentile(window_latency, 0.999) / 1e9}}},
+        {"connect_latency_seconds",
+         {{"p50", LatencyHistogram::percentile(connect_latency, 0.5) / 1e9},
+          {"p99", LatencyHistogram::percentile(connect_latency, 0.99) / 1e9}}},
+        {"throughput",
+         {{"windows_per_second", wall > 0 ? window_count / wall : 0},
+          {"words_per_second", wall > 0 ? words / wall : 0},
+          {"bytes_per_second", wall > 0 ? bytes / wall : 0}}}};
+
+    std::ofstream json_out(options.json_file);
+    json_out << report.dump(4) << std::endl;
+
+    std::ofstream csv_out(options.csv_file);
+    csv_out << "client,arrival_s,connected_s,completed_s,completion_s,windows,words,bytes,failed\n";
+    for (const Session &session : sessions)
+    {
+        csv_out << session.id << "," << session.arrival << "," << session.connected << "," << session.completed << ","
+                << session.completed - session.arrival << "," << session.windows << "," << session.words << ","
+                << session.bytes << "," << session.failed << "\n";
+    }
+
+    std::cout << report.dump(4) << std::endl;
+    std::cout << "Sessions completed: " << completed << ", failed: " << failed << std::endl;
+    std::cout << "Total time taken: " << wall << " seconds" << std::endl;
+    std::cout << "Average time per client: " << average_completion << " seconds" << std::endl;
+    return failed > 0 ? 2 : 0;
+}
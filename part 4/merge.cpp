@@ -0,0 +1,618 @@
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <charconv>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "kernels.hpp"
+#include "output_writer.hpp"
+#include "parallel_sort.hpp"
+
+// Merges per-client frequency files (output_client_<id>.txt and friends)
+// into one histogram. Inputs are memory-mapped and may be "word, count"
+// text, CSV or binary, mixed freely.
+//
+//   ./merge --output merged.txt [--format text|csv|binary] [--order word|count]
+//           [--mode hash|kway] [--threads N] file...
+//
+// --mode hash (the default) takes any inputs: threads parse whole files and
+// route every entry to a partition by hash, then each thread sums one
+// partition in its own table. --mode kway needs inputs sorted by word, as
+// clients write them by default, and streams a k-way merge instead; the word
+// range is cut at splitter words so each thread merges one slice of every
+// file.
+
+static std::atomic<uint64_t> malformed_lines(0);
+
+// One memory-mapped input. Positions are byte offsets of line starts for
+// text and CSV, and entry indexes for binary files. CSV with quoted fields
+// is unquoted once at open into an in-memory binary file and read as one.
+class FrequencyInput
+{
+private:
+    const char *data = nullptr;
+    size_t size = 0;
+    std::string decoded;
+    bool binary = false;
+    uint64_t entry_count = 0;
+    const char *counts = nullptr;
+    const char *word_ends = nullptr;
+    const char *dictionary = nullptr;
+    uint64_t dictionary_bytes = 0;
+
+    uint64_t binary_field(const char *array, uint64_t i) const
+    {
+        uint64_t value;
+        memcpy(&value, array + 8 * i, sizeof(value));
+        return value;
+    }
+
+    bool use_binary(const char *bytes, size_t length)
+    {
+        FrequencyFileHeader header;
+        if (!read_frequency_header(bytes, length, header))
+        {
+            return false;
+        }
+        binary = true;
+        entry_count = header.entry_count;
+        dictionary_bytes = header.dictionary_bytes;
+        counts = bytes + sizeof(header);
+        word_ends = counts + 8 * entry_count;
+        dictionary = word_ends + 8 * entry_count;
+        return true;
+    }
+
+    bool is_csv() const
+    {
+        std::string_view first(data, size);
+        first = first.substr(0, first.find('\n'));
+        return first == "word,count" || first == "word,count\r";
+    }
+
+    // RFC 4180 rows, unquoted, into decoded; the mapping is dropped after
+    void decode_csv()
+    {
+        std::vector<std::pair<std::string, uint64_t>> rows;
+        const char *cursor = data;
+        const char *end = data + size;
+        std::string word, field;
+        while (cursor < end)
+        {
+            const char *row = cursor;
+            if (*cursor == '\r' && cursor + 1 < end && cursor[1] == '\n')
+            {
+                cursor++;
+            }
+            if (*cursor == '\n')
+            {
+                cursor++;
+                continue;
+            }
+            uint64_t count = 0;
+            bool valid = read_csv_field(cursor, end, word) && cursor < end && *cursor == ',';
+            if (valid)
+            {
+                cursor++;
+                valid = read_csv_field(cursor, end, field);
+                auto parsed = std::from_chars(field.data(), field.data() + field.size(), count);
+                valid = valid && parsed.ec == std::errc() && parsed.ptr == field.data() + field.size();
+            }
+            // Anything after the count (an error or projection column) is ignored
+            while (valid && cursor < end && *cursor == ',')
+            {
+                cursor++;
+                valid = read_csv_field(cursor, end, field);
+            }
+            if (valid)
+            {
+                rows.emplace_back(word, count);
+            }
+            else if (!(row == data && word == "word" && field == "count"))
+            {
+                malformed_lines++;
+            }
+            const char *newline = (const char *)memchr(cursor, '\n', end - cursor);
+            cursor = newline == nullptr ? end : newline + 1;
+        }
+        decoded = format_frequency(OutputFormat::Binary, rows);
+        munmap((void *)data, size);
+        data = nullptr;
+        size = 0;
+    }
+
+    bool parse_line(std::string_view line, std::string_view &word, uint64_t &count) const
+    {
+        const char *comma = (const char *)memchr(line.data(), ',', line.size());
+        if (comma == nullptr)
+        {
+            return false;
+        }
+        word = std::string_view(line.data(), comma - line.data());
+        const char *cursor = comma + 1;
+        const char *end = line.data() + line.size();
+        while (cursor < end && *cursor == ' ')
+        {
+            cursor++;
+        }
+        // Anything after the count (an error or projection column) is ignored
+        auto parsed = std::from_chars(cursor, end, count);
+        return parsed.ec == std::errc() && (parsed.ptr == end || *parsed.ptr == ',' || *parsed.ptr == '\r');
+    }
+
+public:
+    std::string path;
+
+    FrequencyInput() = default;
+    FrequencyInput(const FrequencyInput &) = delete;
+    FrequencyInput &operator=(const FrequencyInput &) = delete;
+
+    ~FrequencyInput()
+    {
+        if (size > 0)
+        {
+            munmap((void *)data, size);
+        }
+    }
+
+    bool open(const std::string &file_path)
+    {
+        path = file_path;
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) < 0)
+        {
+            close(fd);
+            return false;
+        }
+        size = info.st_size;
+        if (size > 0)
+        {
+            void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED)
+            {
+                close(fd);
+                size = 0;
+                return false;
+            }
+            data = (const char *)mapped;
+            madvise(mapped, size, MADV_SEQUENTIAL);
+        }
+        close(fd);
+
+        if (size >= sizeof(FREQUENCY_FILE_MAGIC) && memcmp(data, FREQUENCY_FILE_MAGIC, sizeof(FREQUENCY_FILE_MAGIC)) == 0)
+        {
+            return use_binary(data, size);
+        }
+        // Without a quote anywhere, CSV rows read like text lines
+        if (is_csv() && memchr(data, '"', size) != nullptr)
+        {
+            decode_csv();
+            return use_binary(decoded.data(), decoded.size());
+        }
+        return true;
+    }
+
+    size_t begin() const
+    {
+        return 0;
+    }
+
+    size_t end() const
+    {
+        return binary ? entry_count : size;
+    }
+
+    // The entry at or after position, stopping at limit; advances position
+    // past it. Skips blank, header and malformed lines (the last are counted).
+    bool read(size_t &position, size_t limit, std::string_view &word, uint64_t &count) const
+    {
+        if (binary)
+        {
+            while (position < limit)
+            {
+                uint64_t start = position == 0 ? 0 : binary_field(word_ends, position - 1);
+                uint64_t stop = binary_field(word_ends, position);
+                count = binary_field(counts, position);
+                position++;
+                if (stop < start || stop > dictionary_bytes)
+                {
+                    malformed_lines++;
+                    continue;
+                }
+                word = std::string_view(dictionary + start, stop - start);
+                return true;
+            }
+            return false;
+        }
+        while (position < limit)
+        {
+            const char *line = data + position;
+            const char *newline = (const char *)memchr(line, '\n', limit - position);
+            size_t length = newline == nullptr ? limit - position : newline - line;
+            bool header = position == 0 && std::string_view(line, length) == "word,count";
+            position += length + 1;
+            if (length == 0 || header)
+            {
+                continue;
+            }
+            if (parse_line(std::string_view(line, length), word, count))
+            {
+                return true;
+            }
+            malformed_lines++;
+        }
+        position = std::min(position, limit);
+        return false;
+    }
+
+    // First line start at or after byte at, or the end
+    size_t line_start(size_t at) const
+    {
+        if (at == 0 || at >= size)
+        {
+            return std::min(at, size);
+        }
+        const char *newline = (const char *)memchr(data + at - 1, '\n', size - at + 1);
+        return newline == nullptr ? size : newline - data + 1;
+    }
+
+    // First position whose word is not less than word, for sorted inputs
+    size_t lower_bound(std::string_view word) const
+    {
+        size_t low = 0, high = end();
+        while (low < high)
+        {
+            size_t middle = binary ? low + (high - low) / 2 : line_start(low + (high - low) / 2);
+            if (middle >= high)
+            {
+                middle = low;
+            }
+            size_t next = middle;
+            std::string_view found;
+            uint64_t count;
+            if (!read(next, high, found, count))
+            {
+                high = middle;
+            }
+            else if (found < word)
+            {
+                low = std::min(next, high);
+            }
+            else
+            {
+                high = middle;
+            }
+        }
+        return low;
+    }
+
+    // A word near the given fraction of the file, to cut the word range at
+    bool sample_word(double fraction, std::string_view &word) const
+    {
+        size_t position = binary ? (size_t)(fraction * entry_count) : line_start((size_t)(fraction * size));
+        uint64_t count;
+        return read(position, end(), word, count);
+    }
+};
+
+struct PartitionedEntry
+{
+    uint64_t hash;
+    std::string_view word;
+    uint64_t count;
+};
+
+template <typename Work>
+static void run_threads(unsigned threads, Work &&work)
+{
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < threads; t++)
+    {
+        workers.emplace_back(work, t);
+    }
+    work(0);
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+// Threads claim whole files and route each entry to partition
+// (hash >> 32) % threads, so every word is summed by exactly one thread
+static std::vector<WordCountTable> hash_merge(const std::vector<FrequencyInput> &inputs, unsigned threads)
+{
+    // routed[from][to]
+    std::vector<std::vector<std::vector<PartitionedEntry>>> routed(
+        threads, std::vector<std::vector<PartitionedEntry>>(threads));
+    std::atomic<size_t> next_file(0);
+    run_threads(threads, [&](unsigned t)
+                {
+        for (size_t f = next_file++; f < inputs.size(); f = next_file++)
+        {
+            const FrequencyInput &input = inputs[f];
+            size_t position = input.begin();
+            std::string_view word;
+            uint64_t count;
+            while (input.read(position, input.end(), word, count))
+            {
+                uint64_t hash = hash_word(word);
+                routed[t][(hash >> 32) % threads].push_back({hash, word, count});
+            }
+        } });
+
+    std::vector<WordCountTable> tables(threads);
+    run_threads(threads, [&](unsigned t)
+                {
+        for (unsigned from = 0; from < threads; from++)
+        {
+            for (const PartitionedEntry &entry : routed[from][t])
+            {
+                tables[t].add_hashed(entry.hash, entry.word, entry.count);
+            }
+            std::vector<PartitionedEntry>().swap(routed[from][t]);
+        } });
+    return tables;
+}
+
+// Merges [bounds[f].first, bounds[f].second) of every sorted input into
+// merged; false when some input turns out not to be sorted
+static bool kway_merge_slice(const std::vector<FrequencyInput> &inputs,
+                             const std::vector<std::pair<size_t, size_t>> &bounds, std::vector<WordEntry> &merged)
+{
+    struct Head
+    {
+        std::string_view word;
+        uint64_t count;
+        size_t input;
+        size_t position;
+    };
+    auto later = [](const Head &a, const Head &b)
+    {
+        return a.word > b.word;
+    };
+    std::vector<Head> heap;
+    for (size_t f = 0; f < inputs.size(); f++)
+    {
+        Head head{{}, 0, f, bounds[f].first};
+        if (inputs[f].read(head.position, bounds[f].second, head.word, head.count))
+        {
+            heap.push_back(head);
+        }
+    }
+    std::make_heap(heap.begin(), heap.end(), later);
+
+    while (!heap.empty())
+    {
+        std::pop_heap(heap.begin(), heap.end(), later);
+        Head &head = heap.back();
+        if (!merged.empty() && merged.back().first == head.word)
+        {
+            merged.back().second += head.count;
+        }
+        else
+        {
+            merged.emplace_back(head.word, head.count);
+        }
+        std::string_view previous = head.word;
+        if (inputs[head.input].read(head.position, bounds[head.input].second, head.word, head.count))
+        {
+            if (head.word < previous)
+            {
+                std::cerr << "merge: " << inputs[head.input].path << " is not sorted by word, use --mode hash"
+                          << std::endl;
+                return false;
+            }
+            std::push_heap(heap.begin(), heap.end(), later);
+        }
+        else
+        {
+            heap.pop_back();
+        }
+    }
+    return true;
+}
+
+static bool kway_merge(const std::vector<FrequencyInput> &inputs, unsigned threads, std::vector<WordEntry> &merged)
+{
+    // Splitters sampled from the largest input
+    size_t largest = 0;
+    for (size_t f = 1; f < inputs.size(); f++)
+    {
+        if (inputs[f].end() > inputs[largest].end())
+        {
+            largest = f;
+        }
+    }
+    std::vector<std::string_view> splitters;
+    for (unsigned t = 1; t < threads; t++)
+    {
+        std::string_view word;
+        if (inputs[largest].sample_word((double)t / threads, word))
+        {
+            splitters.push_back(word);
+        }
+    }
+    std::sort(splitters.begin(), splitters.end());
+    splitters.erase(std::unique(splitters.begin(), splitters.end()), splitters.end());
+
+    size_t slices = splitters.size() + 1;
+    std::vector<std::vector<std::pair<size_t, size_t>>> bounds(slices, std::vector<std::pair<size_t, size_t>>(inputs.size()));
+    for (size_t f = 0; f < inputs.size(); f++)
+    {
+        size_t start = inputs[f].begin();
+        for (size_t s = 0; s < slices; s++)
+        {
+            size_t stop = s + 1 < slices ? inputs[f].lower_bound(splitters[s]) : inputs[f].end();
+            bounds[s][f] = {start, std::max(start, stop)};
+            start = std::max(start, stop);
+        }
+    }
+
+    std::vector<std::vector<WordEntry>> parts(slices);
+    std::atomic<bool> sorted(true);
+    std::atomic<size_t> next_slice(0);
+    run_threads(std::min<size_t>(threads, slices), [&](unsigned)
+                {
+        for (size_t s = next_slice++; s < slices; s = next_slice++)
+        {
+            if (!kway_merge_slice(inputs, bounds[s], parts[s]))
+            {
+                sorted = false;
+            }
+        } });
+    if (!sorted)
+    {
+        return false;
+    }
+
+    size_t total = 0;
+    for (const auto &part : parts)
+    {
+        total += part.size();
+    }
+    merged.reserve(total);
+    for (auto &part : parts)
+    {
+        merged.insert(merged.end(), part.begin(), part.end());
+        std::vector<WordEntry>().swap(part);
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string output, format_name = "text", order = "word", mode = "hash";
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::string> files;
+    OutputFormat format;
+
+    try
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            std::string key = argv[i];
+            if (key.rfind("--", 0) != 0)
+            {
+                files.push_back(key);
+                continue;
+            }
+            if (i + 1 >= argc)
+            {
+                throw std::invalid_argument("missing value for " + key);
+            }
+            std::string value = argv[++i];
+            if (key == "--output")
+            {
+                output = value;
+            }
+            else if (key == "--format")
+            {
+                format_name = value;
+            }
+            else if (key == "--order")
+            {
+                order = value;
+            }
+            else if (key == "--mode")
+            {
+                mode = value;
+            }
+            else if (key == "--threads")
+            {
+                threads = std::max(1, std::stoi(value));
+            }
+            else
+            {
+                throw std::invalid_argument("unknown option " + key);
+            }
+        }
+        if (output.empty() || files.empty() || !parse_output_format(format_name, format) ||
+            (order != "word" && order != "count") || (mode != "hash" && mode != "kway"))
+        {
+            throw std::invalid_argument("invalid arguments");
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "merge: " << e.what() << "\n"
+                  << "Usage: ./merge --output file [--format text|csv|binary] [--order word|count]\n"
+                     "               [--mode hash|kway] [--threads N] file..."
+                  << std::endl;
+        return 1;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<FrequencyInput> inputs(files.size());
+    for (size_t f = 0; f < files.size(); f++)
+    {
+        if (!inputs[f].open(files[f]))
+        {
+            std::cerr << "Failed to read file: " << files[f] << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<WordEntry> entries;
+    std::vector<WordCountTable> tables;
+    if (mode == "kway")
+    {
+        if (!kway_merge(inputs, threads, entries))
+        {
+            return 1;
+        }
+    }
+    else
+    {
+        tables = hash_merge(inputs, threads);
+        size_t total = 0;
+        for (const WordCountTable &table : tables)
+        {
+            total += table.size();
+        }
+        entries.reserve(total);
+        for (const WordCountTable &table : tables)
+        {
+            table.for_each([&](std::string_view word, uint64_t count)
+                           { entries.emplace_back(word, count); });
+        }
+        if (order == "word")
+        {
+            radix_sort_words(entries, threads);
+        }
+    }
+    if (order == "count")
+    {
+        sort_by_count(entries, threads);
+    }
+
+    if (!write_file(output, format_frequency(format, entries)))
+    {
+        std::cerr << "Failed to write file: " << output << std::endl;
+        return 1;
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> diff = end - start;
+    if (malformed_lines > 0)
+    {
+        std::cerr << "Skipped " << malformed_lines << " malformed lines" << std::endl;
+    }
+    std::cout << "Merged " << files.size() << " files into " << entries.size() << " words in " << diff.count()
+              << " seconds" << std::endl;
+    return 0;
+}
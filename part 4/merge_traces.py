@@ -0,0 +1,21 @@
+import json
+import sys
+
+
+def merge_traces(filenames, output):
+    events = []
+    for filename in filenames:
+        with open(filename) as f:
+            events.extend(json.load(f)["traceEvents"])
+
+    with open(output, "w") as f:
+        json.dump({"displayTimeUnit": "ns", "traceEvents": events}, f)
+
+    print(f"Merged {len(filenames)} traces ({len(events)} events) into {output}")
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 3:
+        print("Usage: python3 merge_traces.py <output.json> <trace.json>...")
+        sys.exit(1)
+    merge_traces(sys.argv[2:], sys.argv[1])
@@ -0,0 +1,162 @@
+#ifndef NGRAMS_HPP
+#define NGRAMS_HPP
+
+// N-gram counting over a word stream. Words are interned to dense 32-bit IDs
+// and the last n IDs are packed into one 128-bit key, so the counter never
+// builds an n-gram string until output. With 32 bits per ID the key holds up
+// to MAX_NGRAM words, and every n-gram is counted. The window carries over
+// between calls, so packet and window boundaries do not break n-grams; the
+// stream must arrive in corpus order.
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include "kernels.hpp"
+
+static const int MAX_NGRAM = 4;
+
+class NgramCounter
+{
+private:
+    struct WordHash
+    {
+        size_t operator()(const std::string &word) const
+        {
+            return hash_word(word);
+        }
+    };
+    using Ids = std::unordered_map<std::string, uint32_t, WordHash>;
+
+    // IDs of the n words, oldest in the high bits of high
+    struct Key
+    {
+        uint64_t high;
+        uint64_t low;
+
+        bool operator==(const Key &other) const
+        {
+            return high == other.high && low == other.low;
+        }
+
+        uint32_t id(int i) const // i words back from the most recent
+        {
+            return (uint32_t)(i < 2 ? low >> (32 * i) : high >> (32 * (i - 2)));
+        }
+    };
+    struct KeyHash
+    {
+        size_t operator()(const Key &key) const
+        {
+            return mix64(key.low ^ mix64(key.high));
+        }
+    };
+
+    int n;
+    uint64_t high_mask; // bits of Key::high the n IDs use
+    Ids ids;
+    std::vector<const std::string *> words; // by ID; map nodes never move
+    std::unordered_map<Key, uint64_t, KeyHash> counts;
+    std::string key; // reused lookup key, so a known word does not allocate
+    Key window = {0, 0};
+    int seen = 0; // words so far, capped at n
+
+public:
+    explicit NgramCounter(int n = 2) : n(n)
+    {
+        if (n < 2 || n > MAX_NGRAM)
+        {
+            throw std::invalid_argument("n-grams of " + std::to_string(n) + " words are not supported, use 2 to " +
+                                        std::to_string(MAX_NGRAM));
+        }
+        high_mask = n == 4 ? ~uint64_t(0) : n == 3 ? 0xffffffff : 0;
+    }
+
+    // Copies re-point the ID table at their own map
+    NgramCounter(const NgramCounter &other) : n(other.n), high_mask(other.high_mask), ids(other.ids),
+                                              words(other.words.size()), counts(other.counts),
+                                              window(other.window), seen(other.seen)
+    {
+        for (const auto &entry : ids)
+        {
+            words[entry.second] = &entry.first;
+        }
+    }
+
+    NgramCounter &operator=(const NgramCounter &other)
+    {
+        NgramCounter copy(other);
+        n = copy.n;
+        high_mask = copy.high_mask;
+        std::swap(ids, copy.ids);
+        std::swap(words, copy.words);
+        std::swap(counts, copy.counts);
+        window = copy.window;
+        seen = copy.seen;
+        return *this;
+    }
+
+    void add(std::string_view word)
+    {
+        key.assign(word.data(), word.size());
+        auto found = ids.find(key);
+        if (found == ids.end())
+        {
+            found = ids.emplace(key, (uint32_t)words.size()).first;
+            words.push_back(&found->first);
+        }
+
+        window.high = ((window.high << 32) | (window.low >> 32)) & high_mask;
+        window.low = (window.low << 32) | found->second;
+        seen = std::min(seen + 1, n);
+        if (seen == n)
+        {
+            counts[window]++;
+        }
+    }
+
+    // Calls visit(const std::string &ngram, uint64_t count), words joined by
+    // single spaces, in no particular order
+    template <typename Visit>
+    void for_each(Visit &&visit) const
+    {
+        std::string ngram;
+        for (const auto &entry : counts)
+        {
+            ngram.clear();
+            for (int i = n - 1; i >= 0; i--)
+            {
+                ngram += *words[entry.first.id(i)];
+                if (i > 0)
+                {
+                    ngram += ' ';
+                }
+            }
+            visit(ngram, entry.second);
+        }
+    }
+
+    size_t size() const
+    {
+        return counts.size();
+    }
+
+    int get_n() const
+    {
+        return n;
+    }
+
+    void clear()
+    {
+        ids.clear();
+        words.clear();
+        counts.clear();
+        window = {0, 0};
+        seen = 0;
+    }
+};
+
+#endif
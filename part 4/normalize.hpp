@@ -0,0 +1,365 @@
+#ifndef NORMALIZE_HPP
+#define NORMALIZE_HPP
+
+// Optional word normalization before counting, so that "Baby", "baby" and
+// "baby!" are one word. Words that are already normal come back as the same
+// view, without a copy. ASCII words are checked and folded 16 bytes at a
+// time with SSE2; only words with non-ASCII bytes take the Unicode path.
+//
+// The Unicode path decodes UTF-8, composes a Latin letter and a following
+// combining grave, acute, circumflex, tilde, diaeresis, ring or cedilla into
+// its precomposed Latin-1 form (the NFC result for those pairs), then case
+// folds Latin-1, Latin Extended-A, Greek and Cyrillic letters, with ß
+// folding to "ss". Other characters, and invalid UTF-8, pass through.
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+struct NormalizeOptions
+{
+    bool fold_case = false;
+    bool strip_punctuation = false; // leading and trailing ASCII punctuation
+    bool unicode = false;           // fold and compose non-ASCII words too
+
+    bool enabled() const
+    {
+        return fold_case || strip_punctuation || unicode;
+    }
+};
+
+static const unsigned HAS_UPPER = 1;
+static const unsigned HAS_NON_ASCII = 2;
+
+// HAS_UPPER if word holds an ASCII capital, HAS_NON_ASCII if it holds a byte
+// of 0x80 or more
+inline unsigned scan_ascii(const char *data, size_t size)
+{
+    unsigned found = 0;
+#ifdef __SSE2__
+    const __m128i below_a = _mm_set1_epi8('A' - 1);
+    const __m128i above_z = _mm_set1_epi8('Z' + 1);
+    size_t i = 0;
+    while (i < size)
+    {
+        // The last partial block goes through a zero-padded copy, so nothing
+        // is read past the word
+        __m128i bytes;
+        if (size - i >= 16)
+        {
+            bytes = _mm_loadu_si128((const __m128i *)(data + i));
+        }
+        else
+        {
+            char block[16] = {0};
+            memcpy(block, data + i, size - i);
+            bytes = _mm_loadu_si128((const __m128i *)block);
+        }
+        // Signed compares: bytes of 0x80 and up are negative, so never capitals
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(bytes, below_a), _mm_cmplt_epi8(bytes, above_z));
+        if (_mm_movemask_epi8(upper) != 0)
+        {
+            found |= HAS_UPPER;
+        }
+        if (_mm_movemask_epi8(bytes) != 0)
+        {
+            found |= HAS_NON_ASCII;
+        }
+        i += 16;
+    }
+#else
+    for (size_t i = 0; i < size; i++)
+    {
+        unsigned char c = data[i];
+        if (c >= 'A' && c <= 'Z')
+        {
+            found |= HAS_UPPER;
+        }
+        if (c >= 0x80)
+        {
+            found |= HAS_NON_ASCII;
+        }
+    }
+#endif
+    return found;
+}
+
+// Lower-cases ASCII capitals in place; other bytes are left alone
+inline void fold_ascii(char *data, size_t size)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i below_a = _mm_set1_epi8('A' - 1);
+    const __m128i above_z = _mm_set1_epi8('Z' + 1);
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(bytes, below_a), _mm_cmplt_epi8(bytes, above_z));
+        _mm_storeu_si128((__m128i *)(data + i), _mm_or_si128(bytes, _mm_and_si128(upper, case_bit)));
+    }
+#endif
+    for (; i < size; i++)
+    {
+        if (data[i] >= 'A' && data[i] <= 'Z')
+        {
+            data[i] += 0x20;
+        }
+    }
+}
+
+inline bool is_ascii_punctuation(char c)
+{
+    return (c >= '!' && c <= '/') || (c >= ':' && c <= '@') || (c >= '[' && c <= '`') || (c >= '{' && c <= '~');
+}
+
+// Code points of UTF-8 text; false on invalid or overlong sequences
+inline bool decode_utf8(std::string_view text, std::vector<uint32_t> &code_points)
+{
+    code_points.clear();
+    size_t i = 0;
+    while (i < text.size())
+    {
+        unsigned char lead = text[i];
+        int length = lead < 0x80 ? 1 : (lead >> 5) == 6 ? 2 : (lead >> 4) == 14 ? 3 : (lead >> 3) == 30 ? 4 : 0;
+        if (length == 0 || i + length > text.size())
+        {
+            return false;
+        }
+        uint32_t code_point = length == 1 ? lead : lead & (0x7f >> length);
+        for (int j = 1; j < length; j++)
+        {
+            unsigned char next = text[i + j];
+            if ((next >> 6) != 2)
+            {
+                return false;
+            }
+            code_point = code_point << 6 | (next & 0x3f);
+        }
+        static const uint32_t smallest[5] = {0, 0, 0x80, 0x800, 0x10000};
+        if (code_point < smallest[length] || code_point > 0x10ffff || (code_point >= 0xd800 && code_point <= 0xdfff))
+        {
+            return false;
+        }
+        code_points.push_back(code_point);
+        i += length;
+    }
+    return true;
+}
+
+inline void encode_utf8(uint32_t code_point, std::string &out)
+{
+    if (code_point < 0x80)
+    {
+        out += (char)code_point;
+    }
+    else if (code_point < 0x800)
+    {
+        out += (char)(0xc0 | code_point >> 6);
+        out += (char)(0x80 | (code_point & 0x3f));
+    }
+    else if (code_point < 0x10000)
+    {
+        out += (char)(0xe0 | code_point >> 12);
+        out += (char)(0x80 | (code_point >> 6 & 0x3f));
+        out += (char)(0x80 | (code_point & 0x3f));
+    }
+    else
+    {
+        out += (char)(0xf0 | code_point >> 18);
+        out += (char)(0x80 | (code_point >> 12 & 0x3f));
+        out += (char)(0x80 | (code_point >> 6 & 0x3f));
+        out += (char)(0x80 | (code_point & 0x3f));
+    }
+}
+
+// Precomposed Latin-1 letter for base + combining mark, or 0
+inline uint32_t compose_latin(uint32_t base, uint32_t mark)
+{
+    // Per mark: the bases it combines with and, in the same order, the results
+    struct Composition
+    {
+        uint32_t mark;
+        const char *bases;
+        const char *composed; // low bytes of U+00xx
+    };
+    static const Composition compositions[] = {
+        {0x300, "AEIOUaeiou", "\xc0\xc8\xcc\xd2\xd9\xe0\xe8\xec\xf2\xf9"},
+        {0x301, "AEIOUYaeiouy", "\xc1\xc9\xcd\xd3\xda\xdd\xe1\xe9\xed\xf3\xfa\xfd"},
+        {0x302, "AEIOUaeiou", "\xc2\xca\xce\xd4\xdb\xe2\xea\xee\xf4\xfb"},
+        {0x303, "ANOano", "\xc3\xd1\xd5\xe3\xf1\xf5"},
+        {0x308, "AEIOUaeiouy", "\xc4\xcb\xcf\xd6\xdc\xe4\xeb\xef\xf6\xfc\xff"},
+        {0x30a, "Aa", "\xc5\xe5"},
+        {0x327, "Cc", "\xc7\xe7"},
+    };
+    if (base >= 0x80)
+    {
+        return 0;
+    }
+    for (const Composition &composition : compositions)
+    {
+        if (composition.mark != mark)
+        {
+            continue;
+        }
+        const char *found = strchr(composition.bases, (char)base);
+        return found == nullptr ? 0 : (unsigned char)composition.composed[found - composition.bases];
+    }
+    return 0;
+}
+
+// Simple case folding for the scripts listed at the top; ß is handled by
+// the caller
+inline uint32_t fold_code_point(uint32_t c)
+{
+    if (c >= 'A' && c <= 'Z')
+    {
+        return c + 0x20;
+    }
+    if (c == 0xb5)
+    {
+        return 0x3bc; // micro sign folds to Greek mu
+    }
+    if (c >= 0xc0 && c <= 0xde && c != 0xd7)
+    {
+        return c + 0x20;
+    }
+    if (c >= 0x100 && c <= 0x17f)
+    {
+        if (c == 0x130 || c == 0x131 || c == 0x138 || c == 0x149)
+        {
+            return c == 0x130 ? 'i' : c;
+        }
+        if (c == 0x178)
+        {
+            return 0xff;
+        }
+        if (c == 0x17f)
+        {
+            return 's';
+        }
+        // Pairs start on even code points, except 0x139-0x148 and 0x179-0x17e
+        bool odd_pairs = (c >= 0x139 && c <= 0x148) || (c >= 0x179 && c <= 0x17e);
+        return (c % 2 == 1) == odd_pairs ? c + 1 : c;
+    }
+    if (c >= 0x391 && c <= 0x3a9 && c != 0x3a2)
+    {
+        return c + 0x20;
+    }
+    if (c == 0x386)
+    {
+        return 0x3ac;
+    }
+    if (c >= 0x388 && c <= 0x38a)
+    {
+        return c + 0x25;
+    }
+    if (c == 0x38c)
+    {
+        return 0x3cc;
+    }
+    if (c == 0x38e || c == 0x38f)
+    {
+        return c + 0x3f;
+    }
+    if (c == 0x3c2)
+    {
+        return 0x3c3; // final sigma
+    }
+    if (c >= 0x400 && c <= 0x40f)
+    {
+        return c + 0x50;
+    }
+    if (c >= 0x410 && c <= 0x42f)
+    {
+        return c + 0x20;
+    }
+    if (((c >= 0x460 && c <= 0x481) || (c >= 0x48a && c <= 0x4bf)) && c % 2 == 0)
+    {
+        return c + 1;
+    }
+    return c;
+}
+
+// Composes and (with fold_case) folds a UTF-8 word into out; false, with out
+// untouched, when it is not valid UTF-8
+inline bool normalize_unicode(std::string_view word, bool fold_case, std::string &out)
+{
+    thread_local std::vector<uint32_t> code_points;
+    if (!decode_utf8(word, code_points))
+    {
+        return false;
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < code_points.size(); i++)
+    {
+        uint32_t composed = kept > 0 ? compose_latin(code_points[kept - 1], code_points[i]) : 0;
+        if (composed != 0)
+        {
+            code_points[kept - 1] = composed;
+        }
+        else
+        {
+            code_points[kept++] = code_points[i];
+        }
+    }
+    out.clear();
+    for (size_t i = 0; i < kept; i++)
+    {
+        uint32_t c = code_points[i];
+        if (fold_case && c == 0xdf)
+        {
+            out += "ss";
+            continue;
+        }
+        encode_utf8(fold_case ? fold_code_point(c) : c, out);
+    }
+    return true;
+}
+
+// The normalized word: a view into word when nothing changes, otherwise a
+// view of scratch. May be empty once punctuation is stripped.
+inline std::string_view normalize_word(std::string_view word, const NormalizeOptions &options, std::string &scratch)
+{
+    if (options.strip_punctuation)
+    {
+        size_t first = 0, last = word.size();
+        while (first < last && is_ascii_punctuation(word[first]))
+        {
+            first++;
+        }
+        while (last > first && is_ascii_punctuation(word[last - 1]))
+        {
+            last--;
+        }
+        word = word.substr(first, last - first);
+    }
+    if (!options.fold_case && !options.unicode)
+    {
+        return word;
+    }
+
+    unsigned found = scan_ascii(word.data(), word.size());
+    if ((found & HAS_NON_ASCII) && options.unicode && normalize_unicode(word, options.fold_case, scratch))
+    {
+        if (scratch == word)
+        {
+            return word;
+        }
+        return scratch;
+    }
+    if ((found & HAS_UPPER) && options.fold_case)
+    {
+        scratch.assign(word.data(), word.size());
+        fold_ascii(&scratch[0], scratch.size());
+        return scratch;
+    }
+    return word;
+}
+
+#endif
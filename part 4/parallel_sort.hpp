@@ -0,0 +1,184 @@
+#ifndef PARALLEL_SORT_HPP
+#define PARALLEL_SORT_HPP
+
+// Output-time ordering of (word, count) entries collected from an unordered
+// table: an MSD radix sort by word (the order std::map used to give) and a
+// merge sort by count, most frequent first. Both split the work over up to
+// `threads` threads once there are enough entries to pay for them.
+
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include <cstring>
+
+using WordEntry = std::pair<std::string_view, uint64_t>;
+
+static const size_t PARALLEL_SORT_MIN_ENTRIES = 1 << 15;
+static const size_t RADIX_CUTOFF = 64; // smaller buckets go to std::sort
+
+// Byte `depth` of word plus one, or 0 once the word has ended, so shorter
+// words sort first
+inline unsigned radix_key(std::string_view word, size_t depth)
+{
+    return depth < word.size() ? (unsigned char)word[depth] + 1 : 0;
+}
+
+// Sorts [first, last), whose words share their first `depth` bytes, using
+// scratch (at least as long) as the scatter buffer
+inline void msd_radix_sort(WordEntry *first, WordEntry *last, WordEntry *scratch, size_t depth)
+{
+    size_t n = last - first;
+    if (n < RADIX_CUTOFF)
+    {
+        std::sort(first, last, [](const WordEntry &a, const WordEntry &b)
+                  { return a.first < b.first; });
+        return;
+    }
+    size_t starts[258] = {0};
+    for (WordEntry *entry = first; entry != last; entry++)
+    {
+        starts[radix_key(entry->first, depth) + 1]++;
+    }
+    for (int key = 1; key < 258; key++)
+    {
+        starts[key] += starts[key - 1];
+    }
+    size_t cursor[257];
+    memcpy(cursor, starts, sizeof(cursor));
+    for (WordEntry *entry = first; entry != last; entry++)
+    {
+        scratch[cursor[radix_key(entry->first, depth)]++] = *entry;
+    }
+    std::copy(scratch, scratch + n, first);
+    // Bucket 0 holds words that ended at depth, which are all equal
+    for (int key = 1; key < 257; key++)
+    {
+        if (starts[key + 1] - starts[key] > 1)
+        {
+            msd_radix_sort(first + starts[key], first + starts[key + 1], scratch + starts[key], depth + 1);
+        }
+    }
+}
+
+// Lexicographic by word. The first byte splits the entries into up to 257
+// buckets; threads then take whole buckets, largest first.
+inline void radix_sort_words(std::vector<WordEntry> &entries, unsigned threads)
+{
+    std::vector<WordEntry> scratch(entries.size());
+    if (threads <= 1 || entries.size() < PARALLEL_SORT_MIN_ENTRIES)
+    {
+        msd_radix_sort(entries.data(), entries.data() + entries.size(), scratch.data(), 0);
+        return;
+    }
+
+    size_t starts[258] = {0};
+    for (const WordEntry &entry : entries)
+    {
+        starts[radix_key(entry.first, 0) + 1]++;
+    }
+    for (int key = 1; key < 258; key++)
+    {
+        starts[key] += starts[key - 1];
+    }
+    size_t cursor[257];
+    memcpy(cursor, starts, sizeof(cursor));
+    for (const WordEntry &entry : entries)
+    {
+        scratch[cursor[radix_key(entry.first, 0)]++] = entry;
+    }
+    entries.swap(scratch);
+
+    std::vector<int> buckets;
+    for (int key = 1; key < 257; key++)
+    {
+        if (starts[key + 1] - starts[key] > 1)
+        {
+            buckets.push_back(key);
+        }
+    }
+    std::sort(buckets.begin(), buckets.end(), [&](int a, int b)
+              { return starts[a + 1] - starts[a] > starts[b + 1] - starts[b]; });
+
+    std::atomic<size_t> next(0);
+    auto work = [&]
+    {
+        for (size_t i = next++; i < buckets.size(); i = next++)
+        {
+            int key = buckets[i];
+            msd_radix_sort(entries.data() + starts[key], entries.data() + starts[key + 1],
+                           scratch.data() + starts[key], 1);
+        }
+    };
+    std::vector<std::thread> workers;
+    threads = std::min<size_t>(threads, buckets.size());
+    for (unsigned t = 1; t < threads; t++)
+    {
+        workers.emplace_back(work);
+    }
+    work();
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+// Most frequent first, ties by word: each thread sorts a slice, then
+// neighbouring slices are merged pairwise, also in parallel
+inline void sort_by_count(std::vector<WordEntry> &entries, unsigned threads)
+{
+    auto by_count = [](const WordEntry &a, const WordEntry &b)
+    {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    };
+    if (threads <= 1 || entries.size() < PARALLEL_SORT_MIN_ENTRIES)
+    {
+        std::sort(entries.begin(), entries.end(), by_count);
+        return;
+    }
+
+    std::vector<size_t> bounds;
+    for (unsigned t = 0; t <= threads; t++)
+    {
+        bounds.push_back(entries.size() * t / threads);
+    }
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&, t]
+                             { std::sort(entries.begin() + bounds[t], entries.begin() + bounds[t + 1], by_count); });
+    }
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+
+    while (bounds.size() > 2)
+    {
+        std::vector<size_t> merged;
+        workers.clear();
+        for (size_t i = 0; i + 1 < bounds.size(); i += 2)
+        {
+            merged.push_back(bounds[i]);
+            // An odd slice out waits for the next round
+            if (i + 2 < bounds.size())
+            {
+                size_t first = bounds[i], middle = bounds[i + 1], last = bounds[i + 2];
+                workers.emplace_back([&, first, middle, last]
+                                     { std::inplace_merge(entries.begin() + first, entries.begin() + middle,
+                                                          entries.begin() + last, by_count); });
+            }
+        }
+        merged.push_back(bounds.back());
+        for (std::thread &worker : workers)
+        {
+            worker.join();
+        }
+        bounds.swap(merged);
+    }
+}
+
+#endif
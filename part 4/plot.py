@@ -1,4 +1,5 @@
 import subprocess
+import sys
 import time
 import json
 import matplotlib.pyplot as plt
@@ -8,7 +9,18 @@ def run_server(scheduling_policy):
     return subprocess.Popen(["./server", scheduling_policy])
 
 
+# python3 plot.py --loadgen drives the server with ./loadgen (closed loop,
+# same client counts) instead of spawning ./client
+USE_LOADGEN = "--loadgen" in sys.argv
+
+
 def run_client(num_clients):
+    if USE_LOADGEN:
+        return subprocess.run(
+            ["./loadgen", "--clients", str(num_clients), "--arrival", "closed"],
+            capture_output=True,
+            text=True,
+        )
     with open("config.json", "r") as f:
         config = json.load(f)
     config["num_clients"] = num_clients
@@ -0,0 +1,85 @@
+import argparse
+import csv
+import json
+import subprocess
+import time
+
+from sweep import CONFIG_FILE, METRICS, confidence_interval, int_list, run_loadgen
+
+# Benchmarks each socket profile against the kernel defaults with ./loadgen.
+# The server is restarted per profile so the listening socket is set up with
+# it too. Scenarios are k:p pairs, e.g.
+#
+#   python3 profiles.py --scenarios 10:2,1000:10,10000:1000 --clients 1,8
+#
+# Prints a table and writes profiles_results.csv.
+
+PROFILES = ["default", "low_latency", "bulk"]
+
+
+def parse_scenarios(text):
+    return [tuple(int(value) for value in pair.split(":")) for pair in text.split(",")]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Benchmark socket profiles with ./loadgen")
+    parser.add_argument("--profiles", default=",".join(PROFILES))
+    parser.add_argument("--scenarios", type=parse_scenarios, default=parse_scenarios("10:2,1000:10,10000:1000"))
+    parser.add_argument("--clients", type=int_list, default=[1, 8])
+    parser.add_argument("--reps", type=int, default=5)
+    parser.add_argument("--policy", default="fifo")
+    parser.add_argument("--arrival", default="closed")
+    parser.add_argument("--rate", type=float, default=500)
+    parser.add_argument("--windows", type=int, default=0)
+    parser.add_argument("--threads", type=int, default=4)
+    parser.add_argument("--timeout", type=float, default=300)
+    parser.add_argument("--output", default="profiles_results.csv")
+    args = parser.parse_args()
+
+    with open(CONFIG_FILE) as f:
+        base_config = json.load(f)
+
+    rows = []
+    try:
+        for profile in args.profiles.split(","):
+            for k, p in args.scenarios:
+                config = dict(base_config, k=k, p=p, socket_profile=profile)
+                with open(CONFIG_FILE, "w") as f:
+                    json.dump(config, f, indent=4)
+                server = subprocess.Popen(["./server", args.policy], stdout=subprocess.DEVNULL)
+                time.sleep(1)  # Give the server time to start
+                try:
+                    for clients in args.clients:
+                        samples = {metric: [] for metric in METRICS}
+                        for rep in range(args.reps):
+                            report = run_loadgen(args, clients, 0, rep)
+                            if report is None:
+                                continue
+                            for metric, (_, extract) in METRICS.items():
+                                samples[metric].append(extract(report))
+                        row = {"profile": profile, "k": k, "p": p, "clients": clients}
+                        for metric, values in samples.items():
+                            mean, half_width = confidence_interval(values) if values else (float("nan"), 0.0)
+                            row[metric] = mean
+                            row[metric + "_ci95"] = half_width
+                        rows.append(row)
+                        print(f"{profile:12} k={k:<6} p={p:<5} clients={clients:<3} "
+                              f"completion {row['completion']:.4f} +/- {row['completion_ci95']:.4f} s  "
+                              f"goodput {row['goodput']:.0f} words/s  p99 window {row['p99_window'] * 1e3:.3f} ms")
+                finally:
+                    server.terminate()
+                    server.wait()
+    finally:
+        with open(CONFIG_FILE, "w") as f:
+            json.dump(base_config, f, indent=4)
+
+    if rows:
+        with open(args.output, "w", newline="") as f:
+            writer = csv.DictWriter(f, fieldnames=list(rows[0].keys()))
+            writer.writeheader()
+            writer.writerows(rows)
+        print(f"Results written to {args.output}")
+
+
+if __name__ == "__main__":
+    main()
@@ -6,16 +6,124 @@
 #include <cstring>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include <unistd.h>
 #include "json.hpp"
 #include <pthread.h>
 #include <queue>
+#include <deque>
+#include <algorithm>
 #include <map>
 #include <chrono>
 #include <climits>
+#include <cerrno>
+#include <cctype>
+#include <random>
+#include <memory>
+#include <stdexcept>
+#include <signal.h>
+#include <sys/stat.h>
+#include "shm_corpus.hpp"
+#include "udp_protocol.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "kernels.hpp"
+#include "socket_tuning.hpp"
+#include "sketches.hpp"
 
 using json = nlohmann::json;
 
+enum class SchedulingPolicy
+{
+    Fifo,
+    Fair,
+    Srpt // shortest remaining work first, from each session's server-side cursor
+};
+
+bool parse_scheduling_policy(const std::string &name, SchedulingPolicy &policy)
+{
+    if (name == "fifo")
+    {
+        policy = SchedulingPolicy::Fifo;
+        return true;
+    }
+    if (name == "fair")
+    {
+        policy = SchedulingPolicy::Fair;
+        return true;
+    }
+    if (name == "srpt")
+    {
+        policy = SchedulingPolicy::Srpt;
+        return true;
+    }
+    return false;
+}
+
+std::string scheduling_policy_name(SchedulingPolicy policy)
+{
+    return policy == SchedulingPolicy::Fifo ? "fifo" : policy == SchedulingPolicy::Fair ? "fair"
+                                                                                        : "srpt";
+}
+
+// config_4.json parsed once into plain fields, so the request path never
+// does string-keyed lookups. k, p, udp_loss and scheduling_policy are
+// picked up on reload; the rest only take effect at startup.
+struct ServerConfig
+{
+    int server_port;
+    int k;
+    int p;
+    std::string filename;
+    SchedulingPolicy policy;
+    std::string shm_name; // empty: corpus is not published
+    int udp_port;         // -1: no datagram mode
+    double udp_loss;
+    int stats_port; // -1: no metrics endpoint
+    int max_window; // cap on the k a client may ask for in "GET <offset> <k> <p>"; 16 * k by default
+    int udp_max_words; // cap on the words answered to one NACK datagram
+    int session_ttl_s; // how long a disconnected session can still be resumed
+    int hll_precision; // of the sketches returned by "DISTINCT"
+    SocketProfile socket_profile;
+
+    static ServerConfig from_json(const json &config, SchedulingPolicy policy)
+    {
+        ServerConfig parsed;
+        parsed.server_port = config.at("server_port").get<int>();
+        parsed.k = config.at("k").get<int>();
+        parsed.p = config.at("p").get<int>();
+        parsed.filename = config.at("filename").get<std::string>();
+        parsed.policy = policy;
+        if (config.contains("scheduling_policy") &&
+            !parse_scheduling_policy(config["scheduling_policy"].get<std::string>(), parsed.policy))
+        {
+            throw std::invalid_argument("scheduling_policy must be 'fifo', 'fair' or 'srpt'");
+        }
+        parsed.shm_name = config.value("shm_name", "");
+        parsed.udp_port = config.value("udp_port", -1);
+        parsed.udp_loss = config.value("udp_loss", 0.0);
+        parsed.stats_port = config.value("stats_port", -1);
+        parsed.max_window = config.value("max_window", 16 * parsed.k);
+        parsed.udp_max_words = config.value("udp_max_words", 4 * parsed.max_window);
+        parsed.session_ttl_s = config.value("session_ttl_s", 600);
+        parsed.hll_precision = config.value("hll_precision", 14);
+        parsed.socket_profile = SocketProfile::from_json(config);
+
+        if (parsed.k <= 0 || parsed.p <= 0 || parsed.max_window <= 0 || parsed.udp_max_words <= 0)
+        {
+            throw std::invalid_argument("k, p, max_window and udp_max_words must be positive");
+        }
+        return parsed;
+    }
+};
+
+volatile sig_atomic_t reload_requested = 0;
+
+void handle_sighup(int)
+{
+    reload_requested = 1;
+}
+
 class Server
 {
 private:
@@ -24,14 +132,44 @@ private:
     int opt = 1;
     int addrlen = sizeof(address);
     std::vector<std::string> words;
-    json config;
+    std::string config_file;
+    std::shared_ptr<const ServerConfig> current_config; // Replaced with std::atomic_store on reload
+    struct timespec config_mtime;
+    pthread_t reload_thread;
     pthread_mutex_t words_mutex;
     pthread_mutex_t queue_mutex;
-    std::queue<std::pair<int, int>> request_queue; // pair of <client_socket, offset>
+    struct QueuedRequest
+    {
+        int client_socket;
+        int offset;
+        std::chrono::steady_clock::time_point enqueued;
+    };
+    std::deque<QueuedRequest> request_queue;
     std::map<int, std::queue<int>> client_queues;  // For fair scheduling
     bool is_serving;
+    int serving_socket;
     pthread_t scheduler_thread;
-    std::string scheduling_policy_given;
+    std::map<int, std::string> pending_input; // Partial request lines per socket
+    std::map<int, uint64_t> connection_words; // Words sent per socket, for per-client stats on close
+
+    // Server-side cursors for "SESSION" / "NEXT" / "RESUME", keyed by resume
+    // token. Only the scheduler thread touches them.
+    struct Session
+    {
+        int cursor;
+        int client_socket; // -1 while disconnected
+        std::chrono::steady_clock::time_point detached;
+    };
+    std::map<std::string, Session> sessions;
+    std::map<int, std::string> socket_sessions;
+    std::random_device token_source;
+    std::unique_ptr<HyperLogLog> corpus_sketch; // whole-corpus "DISTINCT", built on first use
+    std::vector<std::unique_ptr<HyperLogLog>> block_sketches; // per DISTINCT_BLOCK words, built on first use
+    bool shm_published;
+    uint64_t shm_generation = 0; // of the published segment, sent with every grant
+    int udp_fd;
+    pthread_t udp_thread;
+    pthread_t stats_thread;
 
     struct ClientRequest
     {
@@ -40,43 +178,119 @@ private:
     };
 
 public:
-    Server(const std::string &config_file, const std::string &scheduling_policy)
-        : is_serving(false), scheduling_policy_given(scheduling_policy)
+    Server(const std::string &config_file, SchedulingPolicy scheduling_policy)
+        : config_file(config_file), is_serving(false), serving_socket(-1), shm_published(false), udp_fd(-1)
     {
         std::ifstream f(config_file);
-        config = json::parse(f);
+        ServerConfig parsed = ServerConfig::from_json(json::parse(f), scheduling_policy);
+        parsed.policy = scheduling_policy; // The command line wins at startup
+        current_config = std::make_shared<const ServerConfig>(parsed);
+        struct stat sb;
+        if (stat(config_file.c_str(), &sb) == 0)
+        {
+            config_mtime = sb.st_mtim;
+        }
         load_words();
+        publish_corpus();
         pthread_mutex_init(&words_mutex, NULL);
         pthread_mutex_init(&queue_mutex, NULL);
-        scheduling_policy_given = scheduling_policy;
     }
 
     ~Server()
     {
+        if (shm_published)
+        {
+            ShmCorpusWriter::unpublish(settings()->shm_name);
+        }
         pthread_mutex_destroy(&words_mutex);
         pthread_mutex_destroy(&queue_mutex);
     }
 
-    static Server *get_instance(const std::string &scheduling_policy)
+    static Server *get_instance(SchedulingPolicy scheduling_policy)
     {
         static Server instance("config_4.json", scheduling_policy);
         return &instance;
     }
 
+    std::shared_ptr<const ServerConfig> settings() const
+    {
+        return std::atomic_load(&current_config);
+    }
+
+    bool reload_config()
+    {
+        try
+        {
+            std::ifstream f(config_file);
+            std::shared_ptr<const ServerConfig> current = settings();
+            ServerConfig parsed = ServerConfig::from_json(json::parse(f), current->policy);
+            parsed.server_port = current->server_port;
+            parsed.filename = current->filename;
+            parsed.shm_name = current->shm_name;
+            parsed.udp_port = current->udp_port;
+            parsed.stats_port = current->stats_port;
+            std::atomic_store(&current_config, std::make_shared<const ServerConfig>(parsed));
+
+            std::cout << "Config reloaded: k=" << parsed.k << " p=" << parsed.p
+                      << " scheduling=" << scheduling_policy_name(parsed.policy) << std::endl;
+            return true;
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Config reload failed, keeping previous values: " << e.what() << std::endl;
+            return false;
+        }
+    }
+
+    // Reloads on SIGHUP or when the config file's mtime changes. Connections
+    // take a snapshot per request, so new values apply from the next window.
+    void watch_config()
+    {
+        while (true)
+        {
+            usleep(250000);
+
+            struct stat sb;
+            bool changed = stat(config_file.c_str(), &sb) == 0 &&
+                           (sb.st_mtim.tv_sec != config_mtime.tv_sec || sb.st_mtim.tv_nsec != config_mtime.tv_nsec);
+            if (changed)
+            {
+                config_mtime = sb.st_mtim;
+            }
+            if (changed || reload_requested)
+            {
+                reload_requested = 0;
+                reload_config();
+            }
+        }
+    }
+
     void load_words()
     {
-        std::string filename = config["filename"].get<std::string>();
+        std::string filename = settings()->filename;
         std::ifstream file(filename);
-        std::string word;
         if (!file.is_open())
         {
             std::cerr << "Failed to open file: " << filename << std::endl;
             return;
         }
 
-        while (std::getline(file, word, ','))
+        tokenize_corpus(file, words);
+    }
+
+    // Co-located clients can count straight out of this segment and only use
+    // the socket for admission (see grant_shm_window).
+    void publish_corpus()
+    {
+        std::string shm_name = settings()->shm_name;
+        if (shm_name.empty())
         {
-            words.push_back(word);
+            return;
+        }
+        shm_published = ShmCorpusWriter::publish(shm_name, words, shm_generation);
+        if (!shm_published)
+        {
+            std::cerr << "Failed to publish corpus in shared memory: " << shm_name << std::endl;
         }
     }
 
@@ -92,10 +306,13 @@ public:
             std::cerr << "Setsockopt failed" << std::endl;
             return false;
         }
+        // Accepted sockets inherit the buffer sizes, so the handshake already
+        // advertises a window scale that fits them
+        apply_socket_profile(server_fd, settings()->socket_profile);
 
         address.sin_family = AF_INET;
         address.sin_addr.s_addr = INADDR_ANY;
-        address.sin_port = htons(config["server_port"]);
+        address.sin_port = htons(settings()->server_port);
 
         if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0)
         {
@@ -103,7 +320,7 @@ public:
             return false;
         }
 
-        if (listen(server_fd, 3) < 0)
+        if (listen(server_fd, SOMAXCONN) < 0)
         {
             std::cerr << "Listen failed" << std::endl;
             return false;
@@ -112,44 +329,263 @@ public:
         return true;
     }
 
+    bool setup_udp()
+    {
+        if ((udp_fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+        {
+            std::cerr << "UDP socket failed" << std::endl;
+            return false;
+        }
+
+        struct sockaddr_in udp_address;
+        memset(&udp_address, 0, sizeof(udp_address));
+        udp_address.sin_family = AF_INET;
+        udp_address.sin_addr.s_addr = INADDR_ANY;
+        udp_address.sin_port = htons(settings()->udp_port);
+
+        if (bind(udp_fd, (struct sockaddr *)&udp_address, sizeof(udp_address)) < 0)
+        {
+            std::cerr << "UDP bind failed" << std::endl;
+            close(udp_fd);
+            udp_fd = -1;
+            return false;
+        }
+
+        return true;
+    }
+
     static void *handle_client_thread(void *arg)
     {
         ClientRequest *request = static_cast<ClientRequest *>(arg);
-        Server *server = Server::get_instance("");
+        Server *server = Server::get_instance(SchedulingPolicy::Fifo);
         server->handle_client(request->client_socket);
         delete request;
         return NULL;
     }
 
+    bool read_request(int client_socket, std::string &request)
+    {
+        std::string &pending = pending_input[client_socket];
+        char buffer[1024];
+        size_t newline;
+        while ((newline = pending.find('\n')) == std::string::npos)
+        {
+            int valread = read(client_socket, buffer, sizeof(buffer));
+            rearm_quickack(client_socket, settings()->socket_profile);
+            if (valread <= 0)
+            {
+                pending_input.erase(client_socket);
+                return false;
+            }
+            pending.append(buffer, valread);
+        }
+        request = pending.substr(0, newline);
+        pending.erase(0, newline + 1);
+        return true;
+    }
+
+    // Per-client stats are keyed by IP, so ephemeral ports do not add labels
+    static std::string format_ip(const struct sockaddr_in &peer)
+    {
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &peer.sin_addr, ip, sizeof(ip));
+        return ip;
+    }
+
+    void served(int client_socket, uint64_t words, uint64_t bytes)
+    {
+        thread_stats().served(words, bytes);
+        connection_words[client_socket] += words;
+    }
+
+    void close_client(int client_socket)
+    {
+        auto sent = connection_words.find(client_socket);
+        if (sent != connection_words.end())
+        {
+            struct sockaddr_in peer;
+            socklen_t length = sizeof(peer);
+            memset(&peer, 0, sizeof(peer));
+            getpeername(client_socket, (struct sockaddr *)&peer, &length);
+            thread_stats().client_served(format_ip(peer), sent->second);
+            connection_words.erase(sent);
+        }
+        close(client_socket);
+        pending_input.erase(client_socket);
+        detach_session(client_socket);
+        ThreadStats::add(thread_stats().connections_closed);
+    }
+
+    // Serves one request and re-queues the socket. Sockets stay queued after
+    // their last window so they are closed here once the client hangs up.
     void handle_client(int client_socket)
     {
-        char buffer[1024] = {0};
-        int valread = read(client_socket, buffer, 1024);
-        if (valread <= 0)
+        TRACE_SCOPE_ARG("handle_client", client_socket);
+        std::string request;
+        bool received;
+        {
+            TRACE_SCOPE("read_request");
+            received = read_request(client_socket, request);
+        }
+        if (!received)
         {
+            close_client(client_socket);
             return;
         }
 
-        int offset_received = std::stoi(buffer);
+        auto started = std::chrono::steady_clock::now();
+        std::shared_ptr<const ServerConfig> settings = this->settings();
+        int command;
+        int next_offset;
+
+        if (request.compare(0, 4, "SHM ") == 0)
+        {
+            int offset;
+            command = parse_offset(request.c_str() + 4, offset) ? COMMAND_SHM : COMMAND_INVALID;
+            next_offset = command == COMMAND_SHM ? grant_shm_window(client_socket, offset, *settings)
+                                                 : reject_request(client_socket);
+        }
+        else if (request.compare(0, 4, "NEXT") == 0)
+        {
+            command = COMMAND_NEXT;
+            next_offset = serve_next(client_socket, request.c_str() + 4, *settings);
+        }
+        else if (request.compare(0, 4, "GET ") == 0)
+        {
+            // A client may pick its own window: "GET <offset> <k> <p>"
+            int values[3], count;
+            command = parse_numbers(request.c_str() + 4, values, 3, count) && (count == 1 || count == 3)
+                          ? COMMAND_GET
+                          : COMMAND_INVALID;
+            if (command == COMMAND_GET)
+            {
+                int k = count == 3 ? values[1] : settings->k, p = count == 3 ? values[2] : settings->p;
+                clamp_window(k, p, *settings);
+                next_offset = send_framed_window(client_socket, values[0], k, p, *settings);
+            }
+            else
+            {
+                next_offset = reject_request(client_socket);
+            }
+        }
+        else if (request.compare(0, 7, "SESSION") == 0)
+        {
+            command = COMMAND_SESSION;
+            next_offset = open_session(client_socket, request.c_str() + 7, *settings);
+        }
+        else if (request.compare(0, 7, "RESUME ") == 0)
+        {
+            command = COMMAND_SESSION;
+            next_offset = resume_session(client_socket, request.c_str() + 7);
+        }
+        else if (request.compare(0, 7, "RANGES ") == 0)
+        {
+            command = COMMAND_RANGES;
+            next_offset = send_ranges(client_socket, request.c_str() + 7, *settings);
+        }
+        else if (request.compare(0, 8, "DISTINCT") == 0)
+        {
+            command = COMMAND_DISTINCT;
+            next_offset = send_distinct(client_socket, request.c_str() + 8, *settings);
+        }
+        else
+        {
+            int offset;
+            command = parse_offset(request.c_str(), offset) ? COMMAND_OFFSET : COMMAND_INVALID;
+            next_offset = command == COMMAND_OFFSET ? send_window(client_socket, offset, *settings)
+                                                    : reject_request(client_socket);
+        }
+
+        ThreadStats &stats = thread_stats();
+        ThreadStats::add(stats.requests[command]);
+        stats.request_latency[command].record(elapsed_ns(started));
 
+        add_to_queue(client_socket, next_offset);
+    }
+
+    // The whole of text as an offset, so that a typo or a verb missing its
+    // arguments is rejected instead of read as a number
+    static bool parse_offset(const char *text, int &offset)
+    {
+        char *end;
+        errno = 0;
+        long value = strtol(text, &end, 10);
+        while (isspace((unsigned char)*end))
+        {
+            end++;
+        }
+        if (end == text || *end != '\0' || errno == ERANGE || value < INT_MIN || value > INT_MAX)
+        {
+            return false;
+        }
+        offset = (int)value;
+        return true;
+    }
+
+    // Up to capacity whitespace-separated non-negative numbers, each parsed
+    // whole like parse_offset; false on anything else
+    static bool parse_numbers(const char *text, int *values, int capacity, int &count)
+    {
+        count = 0;
+        while (true)
+        {
+            while (isspace((unsigned char)*text))
+            {
+                text++;
+            }
+            if (*text == '\0')
+            {
+                return true;
+            }
+            const char *end = text;
+            while (*end != '\0' && !isspace((unsigned char)*end))
+            {
+                end++;
+            }
+            if (count == capacity || !parse_offset(std::string(text, end - text).c_str(), values[count]) ||
+                values[count] < 0)
+            {
+                return false;
+            }
+            count++;
+            text = end;
+        }
+    }
+
+    // The socket stays queued, so the client can still send a valid request
+    int reject_request(int client_socket)
+    {
+        std::string response = "ERR bad request\n";
+        send(client_socket, response.c_str(), response.length(), 0);
+        return 0;
+    }
+
+    // Plain "<offset>" request: k words in packets of p, with EOF after the last word
+    int send_window(int client_socket, int offset_received, const ServerConfig &settings)
+    {
         pthread_mutex_lock(&words_mutex);
         if (offset_received >= (int)words.size())
         {
             send(client_socket, "$$\n", 3, 0);
             pthread_mutex_unlock(&words_mutex);
-            return;
+            return offset_received;
         }
 
         std::string response;
-        int k = config["k"].get<int>();
-        int p = config["p"].get<int>();
+        int k = settings.k;
+        int p = settings.p;
         int words_sent = 0;
         bool eofAdded = false;
+        int total_words = 0;
+        size_t total_bytes = 0;
 
+        WindowCork cork(client_socket, settings.socket_profile);
+        TRACE_SCOPE_ARG("packetize", offset_received);
         for (int i = 0; i < k && offset_received + i < (int)words.size(); i++)
         {
             response += words[offset_received + i] + ",";
             words_sent++;
+            total_words++;
 
             if (words_sent == p || i == k - 1 || offset_received + i == (int)words.size() - 1)
             {
@@ -160,80 +596,413 @@ public:
                 }
                 response.pop_back();
                 response += "\n";
-                send(client_socket, response.c_str(), response.length(), 0);
+                {
+                    TRACE_SCOPE_ARG("send", response.length());
+                    send(client_socket, response.c_str(), response.length(), 0);
+                }
+                total_bytes += response.length();
                 response.clear();
                 words_sent = 0;
             }
         }
         pthread_mutex_unlock(&words_mutex);
 
-        if (!eofAdded && offset_received + k < (int)words.size())
+        if (!eofAdded && offset_received + k >= (int)words.size())
         {
-            add_to_queue(client_socket, offset_received + k);
+            response = "EOF\n";
+            send(client_socket, response.c_str(), response.length(), 0);
+            total_bytes += response.length();
         }
-        else if (!eofAdded)
+
+        served(client_socket, total_words, total_bytes);
+        return offset_received + total_words;
+    }
+
+    // "GET <offset>": the same packets as a plain offset request, minus the
+    // EOF marker, preceded by "WIN <offset> <count> <remaining>". The client
+    // learns the window size from the header, so k can change between windows.
+    // k and p are the server's unless the client asked for its own.
+    int send_framed_window(int client_socket, int offset, int k, int p, const ServerConfig &settings)
+    {
+        if (offset < 0 || offset >= (int)words.size())
         {
-            response = "EOF\n";
+            send(client_socket, "$$\n", 3, 0);
+            return offset;
+        }
+
+        int count = std::min(k, (int)words.size() - offset);
+        int remaining = (int)words.size() - offset - count;
+        std::string response = "WIN " + std::to_string(offset) + " " + std::to_string(count) + " " +
+                               std::to_string(remaining) + "\n";
+        std::vector<size_t> packet_ends;
+        {
+            TRACE_SCOPE_ARG("packetize", offset);
+            render_window(words, offset, count, p, response, packet_ends);
+        }
+
+        // The header goes out with the first packet
+        WindowCork cork(client_socket, settings.socket_profile);
+        size_t start = 0;
+        for (size_t end : packet_ends)
+        {
+            TRACE_SCOPE_ARG("send", end - start);
+            send(client_socket, response.data() + start, end - start, 0);
+            start = end;
+        }
+
+        served(client_socket, count, response.length());
+        return offset + count;
+    }
+
+    static void clamp_window(int &k, int &p, const ServerConfig &settings)
+    {
+        k = std::max(1, std::min(k, settings.max_window));
+        p = std::max(1, std::min(p, k));
+    }
+
+    // "SESSION [offset]" starts a server-side cursor at offset (default 0) and
+    // replies "SESSION <token> <total>". The client then asks for each window
+    // with a bare "NEXT [k p]" and, after reconnecting, re-attaches with
+    // "RESUME <token> [offset]". Only the first offset comes from the client,
+    // so the remaining work the scheduler sees cannot be inflated later.
+    int open_session(int client_socket, const char *arguments, const ServerConfig &settings)
+    {
+        expire_sessions(settings);
+        int offset = 0;
+        sscanf(arguments, "%d", &offset);
+        offset = std::max(0, std::min(offset, (int)words.size()));
+
+        char token[33];
+        snprintf(token, sizeof(token), "%08x%08x%08x%08x", token_source(), token_source(), token_source(),
+                 token_source());
+        sessions[token] = {offset, -1, std::chrono::steady_clock::now()};
+        attach_session(client_socket, token);
+
+        std::string response = "SESSION " + std::string(token) + " " + std::to_string(words.size()) + "\n";
+        send(client_socket, response.c_str(), response.length(), 0);
+        return offset;
+    }
+
+    // The offset lets a client rewind to the last window it kept (words in
+    // flight when the connection dropped are lost), but never skip ahead.
+    // Replies "RESUMED <offset> <total>".
+    int resume_session(int client_socket, const char *arguments)
+    {
+        char token[33] = "";
+        int offset = -1;
+        int fields = sscanf(arguments, "%32s %d", token, &offset);
+        auto session = sessions.find(token);
+        if (fields < 1 || session == sessions.end())
+        {
+            send(client_socket, "ERR unknown session\n", 20, 0);
+            return 0;
+        }
+        if (fields == 2)
+        {
+            if (offset < 0 || offset > session->second.cursor)
+            {
+                send(client_socket, "ERR offset ahead of session\n", 28, 0);
+                return session->second.cursor;
+            }
+            session->second.cursor = offset;
+        }
+        attach_session(client_socket, session->first);
+
+        std::string response = "RESUMED " + std::to_string(session->second.cursor) + " " +
+                               std::to_string(words.size()) + "\n";
+        send(client_socket, response.c_str(), response.length(), 0);
+        return session->second.cursor;
+    }
+
+    // "NEXT [k p]": the framed window at the session cursor
+    int serve_next(int client_socket, const char *arguments, const ServerConfig &settings)
+    {
+        auto attached = socket_sessions.find(client_socket);
+        if (attached == socket_sessions.end())
+        {
+            send(client_socket, "ERR no session\n", 15, 0);
+            return 0;
+        }
+        int values[2], count;
+        if (!parse_numbers(arguments, values, 2, count) || count == 1)
+        {
+            return reject_request(client_socket);
+        }
+        int k = count == 2 ? values[0] : settings.k, p = count == 2 ? values[1] : settings.p;
+        clamp_window(k, p, settings);
+
+        Session &session = sessions[attached->second];
+        session.cursor = send_framed_window(client_socket, session.cursor, k, p, settings);
+        return session.cursor;
+    }
+
+    // A socket holds at most one session and a session at most one socket
+    void attach_session(int client_socket, const std::string &token)
+    {
+        detach_session(client_socket);
+        Session &session = sessions[token];
+        if (session.client_socket >= 0)
+        {
+            socket_sessions.erase(session.client_socket);
+        }
+        session.client_socket = client_socket;
+        socket_sessions[client_socket] = token;
+    }
+
+    void detach_session(int client_socket)
+    {
+        auto attached = socket_sessions.find(client_socket);
+        if (attached == socket_sessions.end())
+        {
+            return;
+        }
+        Session &session = sessions[attached->second];
+        session.client_socket = -1;
+        session.detached = std::chrono::steady_clock::now();
+        socket_sessions.erase(attached);
+    }
+
+    void expire_sessions(const ServerConfig &settings)
+    {
+        auto now = std::chrono::steady_clock::now();
+        for (auto it = sessions.begin(); it != sessions.end();)
+        {
+            if (it->second.client_socket < 0 && now - it->second.detached > std::chrono::seconds(settings.session_ttl_s))
+            {
+                it = sessions.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    // "RANGES <offset>:<count>,<offset>:<count>,...": one framed window per
+    // range, in order, as if each had been asked for with
+    // "GET <offset> <count> <p>", so sampling clients fetch scattered windows
+    // in one round trip. Each count is capped by max_window.
+    int send_ranges(int client_socket, const char *arguments, const ServerConfig &settings)
+    {
+        int next_offset = 0;
+        const char *cursor = arguments;
+        while (*cursor != '\0')
+        {
+            char *end;
+            long offset = strtol(cursor, &end, 10);
+            if (end == cursor || *end != ':')
+            {
+                break;
+            }
+            cursor = end + 1;
+            long count = strtol(cursor, &end, 10);
+            if (end == cursor)
+            {
+                break;
+            }
+            cursor = *end == ',' ? end + 1 : end;
+
+            int k = (int)std::max(0L, std::min<long>(count, INT_MAX)), p = settings.p;
+            clamp_window(k, p, settings);
+            next_offset = send_framed_window(client_socket, (int)std::min<long>(offset, INT_MAX), k, p, settings);
+        }
+        return next_offset;
+    }
+
+    static const int DISTINCT_BLOCK = 1 << 16;
+
+    // The sketch of words [block * DISTINCT_BLOCK, ...), hashed on first use.
+    // The cache is dropped when a reload changes the precision.
+    const HyperLogLog &block_sketch(int block, int precision)
+    {
+        if (!block_sketches.empty() && block_sketches.front() && block_sketches.front()->get_precision() != precision)
+        {
+            block_sketches.clear();
+        }
+        block_sketches.resize((words.size() + DISTINCT_BLOCK - 1) / DISTINCT_BLOCK);
+        std::unique_ptr<HyperLogLog> &sketch = block_sketches[block];
+        if (!sketch || sketch->get_precision() != precision)
+        {
+            TRACE_SCOPE_ARG("distinct_block", block);
+            sketch = std::make_unique<HyperLogLog>(precision);
+            int end = std::min<int>((block + 1) * DISTINCT_BLOCK, words.size());
+            for (int i = block * DISTINCT_BLOCK; i < end; i++)
+            {
+                sketch->add(words[i]);
+            }
+        }
+        return *sketch;
+    }
+
+    // "DISTINCT [offset count]": a HyperLogLog sketch of the words in the
+    // range (default: the whole corpus), as
+    // "DISTINCT <estimate> <precision> <registers in hex>". Clients merge
+    // sketches of several ranges themselves. Whole blocks of the range merge
+    // cached block sketches, so a request hashes at most the two partial
+    // blocks at its ends; the corpus does not change while the server runs.
+    int send_distinct(int client_socket, const char *arguments, const ServerConfig &settings)
+    {
+        int offset = 0, count = (int)words.size();
+        sscanf(arguments, "%d %d", &offset, &count);
+        offset = std::max(0, std::min(offset, (int)words.size()));
+        count = std::max(0, std::min(count, (int)words.size() - offset));
+
+        bool whole_corpus = offset == 0 && count == (int)words.size();
+        HyperLogLog range_sketch(settings.hll_precision);
+        const HyperLogLog *sketch = &range_sketch;
+        if (whole_corpus && corpus_sketch && corpus_sketch->get_precision() == range_sketch.get_precision())
+        {
+            sketch = corpus_sketch.get();
+        }
+        else
+        {
+            TRACE_SCOPE_ARG("distinct", count);
+            int end = offset + count;
+            int i = offset;
+            while (i < end)
+            {
+                int block = i / DISTINCT_BLOCK;
+                int block_end = std::min<int>((block + 1) * DISTINCT_BLOCK, words.size());
+                if (i == block * DISTINCT_BLOCK && block_end <= end)
+                {
+                    range_sketch.merge(block_sketch(block, range_sketch.get_precision()));
+                    i = block_end;
+                    continue;
+                }
+                for (int stop = std::min(end, block_end); i < stop; i++)
+                {
+                    range_sketch.add(words[i]);
+                }
+            }
+            if (whole_corpus)
+            {
+                corpus_sketch = std::make_unique<HyperLogLog>(range_sketch);
+            }
+        }
+
+        std::string response = "DISTINCT " + std::to_string(sketch->estimate()) + " " +
+                               std::to_string(sketch->get_precision()) + " " + sketch->to_hex() + "\n";
+        send(client_socket, response.c_str(), response.length(), 0);
+        served(client_socket, 0, response.length());
+        return offset + count;
+    }
+
+    // Admission for shared-memory clients: the window goes through the same
+    // scheduler as a socket transfer, but only "WIN <offset> <count> <remaining>
+    // <generation>" is sent and the client reads the words from the segment
+    // itself, after checking that it maps the segment this server published.
+    int grant_shm_window(int client_socket, int offset, const ServerConfig &settings)
+    {
+        if (!shm_published)
+        {
+            std::string response = "ERR shm unavailable\n";
             send(client_socket, response.c_str(), response.length(), 0);
+            return offset;
         }
+        if (offset < 0 || offset >= (int)words.size())
+        {
+            send(client_socket, "$$\n", 3, 0);
+            return offset;
+        }
+
+        int count = std::min(settings.k, (int)words.size() - offset);
+        int remaining = (int)words.size() - offset - count;
+        std::string response = "WIN " + std::to_string(offset) + " " + std::to_string(count) + " " +
+                               std::to_string(remaining) + " " + std::to_string(shm_generation) + "\n";
+        send(client_socket, response.c_str(), response.length(), 0);
+
+        served(client_socket, count, 0);
+        return offset + count;
     }
 
+    // In fair mode a socket is in request_queue at most once; its other
+    // offsets wait in client_queues. The socket being served is re-queued by
+    // the scheduler after handle_client, so it is never pushed here. This
+    // invariant also holds across a live switch between policies.
     void add_to_queue(int client_socket, int offset)
     {
+        SchedulingPolicy policy = settings()->policy;
         pthread_mutex_lock(&queue_mutex);
-        if (scheduling_policy_given == "fifo")
+        if (policy != SchedulingPolicy::Fair)
         {
-            request_queue.push({client_socket, offset});
+            request_queue.push_back({client_socket, offset, std::chrono::steady_clock::now()});
         }
-        else if (scheduling_policy_given == "fair")
+        else
         {
             client_queues[client_socket].push(offset);
-            if (client_queues[client_socket].size() == 1)
+            if (client_queues[client_socket].size() == 1 && client_socket != serving_socket)
             {
-                request_queue.push({client_socket, offset});
+                request_queue.push_back({client_socket, offset, std::chrono::steady_clock::now()});
             }
         }
         pthread_mutex_unlock(&queue_mutex);
     }
 
+    // Words ahead of a socket's session cursor, which srpt ranks by. Other
+    // sockets name their own offsets, which a client could inflate, so they
+    // rank behind every session, first come first served.
+    long remaining_work(int client_socket)
+    {
+        auto attached = socket_sessions.find(client_socket);
+        if (attached == socket_sessions.end())
+        {
+            return LONG_MAX;
+        }
+        auto session = sessions.find(attached->second);
+        return session == sessions.end() ? LONG_MAX : (long)words.size() - session->second.cursor;
+    }
+
     void run_scheduler()
     {
+        TRACE_THREAD_NAME("scheduler");
         while (true)
         {
             pthread_mutex_lock(&queue_mutex);
             if (!request_queue.empty())
             {
-                auto [client_socket, offset] = request_queue.front();
-                request_queue.pop();
+                auto next = request_queue.begin();
+                if (settings()->policy == SchedulingPolicy::Srpt)
+                {
+                    next = std::min_element(request_queue.begin(), request_queue.end(),
+                                            [this](const QueuedRequest &a, const QueuedRequest &b)
+                                            { return remaining_work(a.client_socket) < remaining_work(b.client_socket); });
+                }
+                auto [client_socket, offset, enqueued] = *next;
+                request_queue.erase(next);
+                thread_stats().queue_wait.record(elapsed_ns(enqueued));
+                TRACE_SINCE("queue_wait", enqueued, client_socket);
 
-                if (scheduling_policy_given == "fair")
+                auto fair_queue = client_queues.find(client_socket);
+                if (fair_queue != client_queues.end() && !fair_queue->second.empty())
                 {
-                    client_queues[client_socket].pop();
+                    fair_queue->second.pop();
                 }
+                serving_socket = client_socket;
 
                 pthread_mutex_unlock(&queue_mutex);
 
                 // // printf("Serving client %d at offset %d (%s Scheduling)\n",
-                //        client_socket, offset, scheduling_policy_given.c_str());
+                //        client_socket, offset, scheduling_policy_name(settings()->policy).c_str());
 
                 is_serving = true;
                 handle_client(client_socket);
                 is_serving = false;
 
-                if (scheduling_policy_given == "fair")
+                pthread_mutex_lock(&queue_mutex);
+                serving_socket = -1;
+                fair_queue = client_queues.find(client_socket);
+                if (fair_queue != client_queues.end())
                 {
-                    pthread_mutex_lock(&queue_mutex);
-                    if (!client_queues[client_socket].empty())
+                    if (!fair_queue->second.empty())
                     {
-                        int next_offset = client_queues[client_socket].front();
-                        request_queue.push({client_socket, next_offset});
+                        request_queue.push_back({client_socket, fair_queue->second.front(), std::chrono::steady_clock::now()});
                     }
                     else
                     {
-                        client_queues.erase(client_socket);
+                        client_queues.erase(fair_queue);
                     }
-                    pthread_mutex_unlock(&queue_mutex);
                 }
+                pthread_mutex_unlock(&queue_mutex);
             }
             else
             {
@@ -243,6 +1012,206 @@ public:
         }
     }
 
+    // Datagram mode is stateless on the server: every NACK names the word
+    // ranges it wants, so it is served directly instead of going through the
+    // scheduler. "udp_loss" drops that fraction of outgoing datagrams to
+    // exercise retransmission over loopback. Senders are not authenticated,
+    // so send_udp_ranges bounds what one NACK can make the server send.
+    void run_udp()
+    {
+        TRACE_THREAD_NAME("udp");
+        const int batch = 32;
+        std::vector<char> buffers(batch * UDP_MAX_DATAGRAM);
+        struct mmsghdr msgs[batch];
+        struct iovec iovecs[batch];
+        struct sockaddr_in senders[batch];
+
+        std::mt19937 generator(std::random_device{}());
+
+        while (true)
+        {
+            memset(msgs, 0, sizeof(msgs));
+            for (int i = 0; i < batch; i++)
+            {
+                iovecs[i].iov_base = &buffers[i * UDP_MAX_DATAGRAM];
+                iovecs[i].iov_len = UDP_MAX_DATAGRAM;
+                msgs[i].msg_hdr.msg_iov = &iovecs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+                msgs[i].msg_hdr.msg_name = &senders[i];
+                msgs[i].msg_hdr.msg_namelen = sizeof(senders[i]);
+            }
+
+            int received = recvmmsg(udp_fd, msgs, batch, MSG_WAITFORONE, NULL);
+            if (received < 0)
+            {
+                std::cerr << "UDP receive failed" << std::endl;
+                continue;
+            }
+
+            for (int i = 0; i < received; i++)
+            {
+                TRACE_SCOPE("udp_request");
+                auto started = std::chrono::steady_clock::now();
+                std::vector<WordRange> ranges = parse_nack(&buffers[i * UDP_MAX_DATAGRAM], msgs[i].msg_len);
+                send_udp_ranges(senders[i], ranges, *settings(), generator);
+
+                ThreadStats &stats = thread_stats();
+                ThreadStats::add(stats.requests[COMMAND_NACK]);
+                stats.request_latency[COMMAND_NACK].record(elapsed_ns(started));
+            }
+        }
+    }
+
+    void send_udp_ranges(const struct sockaddr_in &client_address, const std::vector<WordRange> &ranges,
+                         const ServerConfig &settings, std::mt19937 &generator)
+    {
+        uint32_t total = words.size();
+        int p = settings.p;
+        std::bernoulli_distribution drop(settings.udp_loss);
+        std::vector<std::string> datagrams;
+        uint64_t total_words = 0;
+        uint64_t total_bytes = 0;
+        // Words still to answer; ranges past it are dropped, the client
+        // NACKs them again
+        uint64_t budget = settings.udp_max_words;
+        bool answered_out_of_range = false;
+
+        for (const auto &range : ranges)
+        {
+            uint32_t offset = range.first;
+            if (offset >= total)
+            {
+                // Answered once, so the client learns the corpus size
+                if (!answered_out_of_range)
+                {
+                    std::string datagram(sizeof(UdpDatagramHeader), '\0');
+                    encode_udp_header(&datagram[0], offset, 0, total);
+                    datagrams.push_back(datagram);
+                    answered_out_of_range = true;
+                }
+                continue;
+            }
+            uint64_t wanted = std::min<uint64_t>({range.second, (uint64_t)settings.max_window, budget});
+            uint64_t end = std::min<uint64_t>((uint64_t)offset + wanted, total);
+            budget -= end - offset;
+
+            while (offset < end)
+            {
+                std::string datagram(sizeof(UdpDatagramHeader), '\0');
+                if (words[offset].size() > UDP_MAX_PAYLOAD)
+                {
+                    encode_udp_header(&datagram[0], offset, 0, total, UDP_FLAG_WORD_TOO_LONG);
+                    datagrams.push_back(datagram);
+                    break;
+                }
+                uint16_t count = 0;
+                while (offset + count < end && count < p)
+                {
+                    const std::string &word = words[offset + count];
+                    size_t needed = word.size() + (count > 0 ? 1 : 0);
+                    if (count > 0 && datagram.size() - sizeof(UdpDatagramHeader) + needed > UDP_MAX_PAYLOAD)
+                    {
+                        break;
+                    }
+                    if (count > 0)
+                    {
+                        datagram += ',';
+                    }
+                    datagram += word;
+                    count++;
+                }
+                encode_udp_header(&datagram[0], offset, count, total);
+                offset += count;
+
+                if (settings.udp_loss > 0 && drop(generator))
+                {
+                    continue;
+                }
+                total_words += count;
+                total_bytes += datagram.size();
+                datagrams.push_back(datagram);
+            }
+        }
+
+        thread_stats().served(total_words, total_bytes);
+        thread_stats().client_served(format_ip(client_address), total_words);
+
+        const size_t batch = 64;
+        struct mmsghdr msgs[batch];
+        struct iovec iovecs[batch];
+        for (size_t start = 0; start < datagrams.size(); start += batch)
+        {
+            size_t n = std::min(batch, datagrams.size() - start);
+            memset(msgs, 0, sizeof(msgs));
+            for (size_t i = 0; i < n; i++)
+            {
+                iovecs[i].iov_base = (void *)datagrams[start + i].data();
+                iovecs[i].iov_len = datagrams[start + i].size();
+                msgs[i].msg_hdr.msg_iov = &iovecs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+                msgs[i].msg_hdr.msg_name = (void *)&client_address;
+                msgs[i].msg_hdr.msg_namelen = sizeof(client_address);
+            }
+            TRACE_SCOPE_ARG("sendmmsg", n);
+            size_t sent = 0;
+            while (sent < n)
+            {
+                int rc = sendmmsg(udp_fd, msgs + sent, n - sent, 0);
+                if (rc <= 0)
+                {
+                    break;
+                }
+                sent += rc;
+            }
+        }
+    }
+
+    // OpenMetrics text on a local HTTP port, kept off the scheduler so a
+    // scrape never waits behind client requests.
+    void run_stats()
+    {
+        int stats_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (stats_fd < 0)
+        {
+            std::cerr << "Stats socket failed" << std::endl;
+            return;
+        }
+        setsockopt(stats_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+        struct sockaddr_in stats_address;
+        memset(&stats_address, 0, sizeof(stats_address));
+        stats_address.sin_family = AF_INET;
+        stats_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        stats_address.sin_port = htons(settings()->stats_port);
+
+        if (bind(stats_fd, (struct sockaddr *)&stats_address, sizeof(stats_address)) < 0 || listen(stats_fd, 8) < 0)
+        {
+            std::cerr << "Stats bind failed" << std::endl;
+            close(stats_fd);
+            return;
+        }
+
+        while (true)
+        {
+            int scrape_socket = accept(stats_fd, NULL, NULL);
+            if (scrape_socket < 0)
+            {
+                continue;
+            }
+            char buffer[1024];
+            if (read(scrape_socket, buffer, sizeof(buffer)) > 0)
+            {
+                std::string body = StatsRegistry::instance().render();
+                std::string response = "HTTP/1.1 200 OK\r\n"
+                                       "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+                                       "Content-Length: " +
+                                       std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+                send(scrape_socket, response.c_str(), response.length(), MSG_NOSIGNAL);
+            }
+            close(scrape_socket);
+        }
+    }
+
     void run()
     {
         if (!setup_server())
@@ -250,13 +1219,43 @@ public:
             return;
         }
 
-        std::cout << "Server is running with " << scheduling_policy_given << " scheduling..." << std::endl;
+        std::cout << "Server is running with " << scheduling_policy_name(settings()->policy) << " scheduling..."
+                  << std::endl;
 
         pthread_create(&scheduler_thread, NULL, [](void *arg) -> void *
                        {
             static_cast<Server*>(arg)->run_scheduler();
             return NULL; }, this);
 
+        struct sigaction sa;
+        sa.sa_handler = handle_sighup;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGHUP, &sa, NULL);
+
+        pthread_create(&reload_thread, NULL, [](void *arg) -> void *
+                       {
+            static_cast<Server*>(arg)->watch_config();
+            return NULL; }, this);
+
+        if (settings()->stats_port >= 0)
+        {
+            std::cout << "Serving metrics on http://127.0.0.1:" << settings()->stats_port << "/metrics" << std::endl;
+            pthread_create(&stats_thread, NULL, [](void *arg) -> void *
+                           {
+                static_cast<Server*>(arg)->run_stats();
+                return NULL; }, this);
+        }
+
+        if (settings()->udp_port >= 0 && setup_udp())
+        {
+            std::cout << "Serving datagram mode on UDP port " << settings()->udp_port << std::endl;
+            pthread_create(&udp_thread, NULL, [](void *arg) -> void *
+                           {
+                static_cast<Server*>(arg)->run_udp();
+                return NULL; }, this);
+        }
+
         while (true)
         {
             int new_socket;
@@ -266,6 +1265,10 @@ public:
                 continue;
             }
 
+            TRACE_INSTANT("accept", new_socket);
+            // Picks up a profile changed by a reload
+            apply_socket_profile(new_socket, settings()->socket_profile);
+            ThreadStats::add(thread_stats().connections_opened);
             add_to_queue(new_socket, 0);
         }
 
@@ -282,13 +1285,19 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    std::string scheduling_policy = argv[1];
-    if (scheduling_policy != "fifo" && scheduling_policy != "fair")
+    SchedulingPolicy scheduling_policy;
+    if (!parse_scheduling_policy(argv[1], scheduling_policy))
     {
-        std::cerr << "Invalid scheduling policy. Use 'fifo' or 'fair'." << std::endl;
+        std::cerr << "Invalid scheduling policy. Use 'fifo', 'fair' or 'srpt'." << std::endl;
         return 1;
     }
 
+    // A pipelining client may hang up with replies still queued; that must
+    // fail the send, not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    TRACE_START("server");
+    TRACE_THREAD_NAME("accept");
     Server server("config_4.json", scheduling_policy);
     server.run();
     return 0;
@@ -0,0 +1,226 @@
+#ifndef SHM_CORPUS_HPP
+#define SHM_CORPUS_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <atomic>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Segment layout:
+//   [ShmCorpusHeader][uint64_t word_index[word_count + 1]][corpus bytes]
+// word i occupies bytes [word_index[i], word_index[i + 1]) of the byte area.
+constexpr char SHM_CORPUS_MAGIC[8] = {'W', 'C', 'C', 'O', 'R', 'P', 'U', 'S'};
+constexpr uint32_t SHM_CORPUS_VERSION = 1;
+
+struct ShmCorpusHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t generation;
+    uint64_t word_count;
+    uint64_t byte_count;
+    uint64_t index_offset;
+    uint64_t bytes_offset;
+    uint64_t total_size;
+};
+
+// Server side: writes the loaded corpus into a named POSIX shared memory
+// segment. The magic is written last so readers never see a half-built segment.
+class ShmCorpusWriter
+{
+public:
+    // generation identifies this copy, for the server to send with grants
+    static bool publish(const std::string &name, const std::vector<std::string> &words, uint64_t &generation)
+    {
+        uint64_t byte_count = 0;
+        for (const auto &word : words)
+        {
+            byte_count += word.size();
+        }
+
+        ShmCorpusHeader header = {};
+        header.version = SHM_CORPUS_VERSION;
+        header.header_size = sizeof(ShmCorpusHeader);
+        header.generation = std::chrono::steady_clock::now().time_since_epoch().count();
+        header.word_count = words.size();
+        header.byte_count = byte_count;
+        header.index_offset = sizeof(ShmCorpusHeader);
+        header.bytes_offset = header.index_offset + (words.size() + 1) * sizeof(uint64_t);
+        header.total_size = header.bytes_offset + byte_count;
+
+        shm_unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd == -1)
+        {
+            return false;
+        }
+        if (ftruncate(fd, header.total_size) == -1)
+        {
+            close(fd);
+            shm_unlink(name.c_str());
+            return false;
+        }
+        char *base = (char *)mmap(nullptr, header.total_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED)
+        {
+            shm_unlink(name.c_str());
+            return false;
+        }
+
+        uint64_t *index = (uint64_t *)(base + header.index_offset);
+        char *bytes = base + header.bytes_offset;
+        uint64_t position = 0;
+        for (size_t i = 0; i < words.size(); i++)
+        {
+            index[i] = position;
+            memcpy(bytes + position, words[i].data(), words[i].size());
+            position += words[i].size();
+        }
+        index[words.size()] = position;
+
+        memcpy(base, &header, sizeof(header));
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(base, SHM_CORPUS_MAGIC, sizeof(SHM_CORPUS_MAGIC));
+
+        munmap(base, header.total_size);
+        generation = header.generation;
+        return true;
+    }
+
+    static void unpublish(const std::string &name)
+    {
+        shm_unlink(name.c_str());
+    }
+};
+
+// Client side: read-only view of a published corpus.
+class ShmCorpusReader
+{
+private:
+    const char *base = nullptr;
+    size_t size = 0;
+    const ShmCorpusHeader *header = nullptr;
+    const uint64_t *index = nullptr;
+    const char *bytes = nullptr;
+
+public:
+    ShmCorpusReader() = default;
+    ShmCorpusReader(const ShmCorpusReader &) = delete;
+    ShmCorpusReader &operator=(const ShmCorpusReader &) = delete;
+
+    ~ShmCorpusReader()
+    {
+        detach();
+    }
+
+    bool attach(const std::string &name)
+    {
+        detach();
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd == -1)
+        {
+            return false;
+        }
+        struct stat sb;
+        if (fstat(fd, &sb) == -1 || (size_t)sb.st_size < sizeof(ShmCorpusHeader))
+        {
+            close(fd);
+            return false;
+        }
+        void *mapped = mmap(nullptr, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED)
+        {
+            return false;
+        }
+        base = (const char *)mapped;
+        size = sb.st_size;
+        header = (const ShmCorpusHeader *)base;
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (memcmp(header->magic, SHM_CORPUS_MAGIC, sizeof(SHM_CORPUS_MAGIC)) != 0 ||
+            header->version != SHM_CORPUS_VERSION ||
+            header->header_size != sizeof(ShmCorpusHeader) ||
+            header->total_size > size || !layout_valid())
+        {
+            detach();
+            return false;
+        }
+        return true;
+    }
+
+private:
+    // The sections lie inside the segment in order, and every word inside
+    // the byte area, so word() never reads outside the mapping
+    bool layout_valid()
+    {
+        const ShmCorpusHeader &h = *header;
+        if (h.index_offset < sizeof(ShmCorpusHeader) || h.index_offset > h.total_size ||
+            h.index_offset % sizeof(uint64_t) != 0 ||
+            h.word_count >= (h.total_size - h.index_offset) / sizeof(uint64_t) ||
+            h.bytes_offset < h.index_offset + (h.word_count + 1) * sizeof(uint64_t) || h.bytes_offset > h.total_size ||
+            h.byte_count > h.total_size - h.bytes_offset)
+        {
+            return false;
+        }
+        index = (const uint64_t *)(base + h.index_offset);
+        bytes = base + h.bytes_offset;
+        if (index[0] != 0)
+        {
+            return false;
+        }
+        for (uint64_t i = 0; i < h.word_count; i++)
+        {
+            if (index[i + 1] < index[i] || index[i + 1] > h.byte_count)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+public:
+    void detach()
+    {
+        if (base != nullptr)
+        {
+            munmap((void *)base, size);
+        }
+        base = nullptr;
+        size = 0;
+        header = nullptr;
+        index = nullptr;
+        bytes = nullptr;
+    }
+
+    bool attached() const
+    {
+        return base != nullptr;
+    }
+
+    uint64_t word_count() const
+    {
+        return header->word_count;
+    }
+
+    uint64_t generation() const
+    {
+        return header->generation;
+    }
+
+    std::string_view word(uint64_t i) const
+    {
+        return std::string_view(bytes + index[i], index[i + 1] - index[i]);
+    }
+};
+
+#endif
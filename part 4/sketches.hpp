@@ -0,0 +1,333 @@
+#ifndef SKETCHES_HPP
+#define SKETCHES_HPP
+
+// Bounded-memory summaries for corpora whose vocabulary does not fit in an
+// exact table.
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <ostream>
+#include <cstdint>
+#include <cmath>
+#include <stdexcept>
+#include "kernels.hpp"
+
+// Space-Saving heavy hitters (Metwally et al.): at most `capacity` counters.
+// An unmonitored word takes over the smallest counter and inherits its
+// count as error. Every reported count over-estimates the true count by at
+// most its error, and every error is at most total() / capacity, so any word
+// more frequent than that is guaranteed to be monitored.
+class SpaceSaving
+{
+public:
+    struct Counter
+    {
+        std::string word;
+        uint64_t count;
+        uint64_t error; // count - error <= true count <= count
+    };
+
+private:
+    struct WordHash
+    {
+        size_t operator()(const std::string &word) const
+        {
+            return hash_word(word);
+        }
+    };
+    using Index = std::unordered_map<std::string, size_t, WordHash>; // word -> position in heap
+
+    // Heap entries point at their index node (nodes never move), so
+    // reordering the heap does not re-hash any word
+    struct Slot
+    {
+        uint64_t count;
+        uint64_t error;
+        Index::value_type *entry;
+    };
+
+    std::vector<Slot> heap; // min-heap on count
+    Index index;
+    size_t capacity;
+    uint64_t total_count = 0;
+    std::string key; // reused lookup key, so a hit does not allocate
+
+    void place(size_t i, const Slot &slot)
+    {
+        heap[i] = slot;
+        heap[i].entry->second = i;
+    }
+
+    void sift_down(size_t i)
+    {
+        Slot moving = heap[i];
+        while (true)
+        {
+            size_t smallest = i;
+            uint64_t smallest_count = moving.count;
+            size_t left = 2 * i + 1, right = 2 * i + 2;
+            if (left < heap.size() && heap[left].count < smallest_count)
+            {
+                smallest = left;
+                smallest_count = heap[left].count;
+            }
+            if (right < heap.size() && heap[right].count < smallest_count)
+            {
+                smallest = right;
+            }
+            if (smallest == i)
+            {
+                break;
+            }
+            place(i, heap[smallest]);
+            i = smallest;
+        }
+        place(i, moving);
+    }
+
+    void sift_up(size_t i)
+    {
+        Slot moving = heap[i];
+        while (i > 0 && heap[(i - 1) / 2].count > moving.count)
+        {
+            place(i, heap[(i - 1) / 2]);
+            i = (i - 1) / 2;
+        }
+        place(i, moving);
+    }
+
+public:
+    explicit SpaceSaving(size_t capacity = 1024) : capacity(std::max<size_t>(1, capacity))
+    {
+        heap.reserve(this->capacity);
+        index.reserve(this->capacity);
+    }
+
+    // Copies re-point the heap at their own index
+    SpaceSaving(const SpaceSaving &other) : heap(other.heap), index(other.index), capacity(other.capacity),
+                                            total_count(other.total_count)
+    {
+        for (Slot &slot : heap)
+        {
+            slot.entry = &*index.find(slot.entry->first);
+        }
+    }
+
+    SpaceSaving &operator=(const SpaceSaving &other)
+    {
+        SpaceSaving copy(other);
+        std::swap(heap, copy.heap);
+        std::swap(index, copy.index);
+        capacity = copy.capacity;
+        total_count = copy.total_count;
+        return *this;
+    }
+
+    void add(std::string_view word, uint64_t count = 1)
+    {
+        total_count += count;
+        key.assign(word.data(), word.size());
+        auto found = index.find(key);
+        if (found != index.end())
+        {
+            heap[found->second].count += count;
+            sift_down(found->second);
+            return;
+        }
+        if (heap.size() < capacity)
+        {
+            auto inserted = index.emplace(key, heap.size()).first;
+            heap.push_back({count, 0, &*inserted});
+            sift_up(heap.size() - 1);
+            return;
+        }
+
+        // The smallest counter changes hands; its index node is reused
+        Slot &smallest = heap.front();
+        auto node = index.extract(smallest.entry->first);
+        node.key() = key;
+        node.mapped() = 0;
+        smallest.entry = &*index.insert(std::move(node)).position;
+        smallest.error = smallest.count;
+        smallest.count += count;
+        sift_down(0);
+    }
+
+    // The k largest counters, most frequent first (ties by word)
+    std::vector<Counter> top(size_t k) const
+    {
+        std::vector<Counter> result;
+        result.reserve(heap.size());
+        for (const Slot &slot : heap)
+        {
+            result.push_back({slot.entry->first, slot.count, slot.error});
+        }
+        auto by_count = [](const Counter &a, const Counter &b)
+        {
+            return a.count != b.count ? a.count > b.count : a.word < b.word;
+        };
+        k = std::min(k, result.size());
+        std::partial_sort(result.begin(), result.begin() + k, result.end(), by_count);
+        result.resize(k);
+        return result;
+    }
+
+    // Largest possible over-estimate of any count
+    uint64_t max_error() const
+    {
+        return heap.size() < capacity ? 0 : heap.front().count;
+    }
+
+    uint64_t total() const
+    {
+        return total_count;
+    }
+
+    size_t size() const
+    {
+        return heap.size();
+    }
+
+    void clear()
+    {
+        heap.clear();
+        index.clear();
+        total_count = 0;
+    }
+};
+
+// HyperLogLog distinct counter: 2^precision one-byte registers, about
+// 1.04 / sqrt(2^precision) relative error (0.8% at the default 14). Sketches
+// of the same precision merge by register-wise max, so counts over disjoint
+// or overlapping ranges combine into the count of their union.
+class HyperLogLog
+{
+private:
+    int precision;
+    std::vector<uint8_t> registers;
+
+public:
+    explicit HyperLogLog(int precision = 14) : precision(std::max(4, std::min(precision, 18))),
+                                               registers(size_t(1) << this->precision, 0)
+    {
+    }
+
+    void add_hash(uint64_t hash)
+    {
+        size_t index = hash >> (64 - precision);
+        // Rank of the first set bit in the remaining bits; the sentinel caps it
+        uint64_t rest = (hash << precision) | (uint64_t(1) << (precision - 1));
+        uint8_t rank = __builtin_clzll(rest) + 1;
+        if (rank > registers[index])
+        {
+            registers[index] = rank;
+        }
+    }
+
+    void add(std::string_view word)
+    {
+        add_hash(hash_word(word));
+    }
+
+    // Throws std::invalid_argument when the precisions differ
+    void merge(const HyperLogLog &other)
+    {
+        if (other.precision != precision)
+        {
+            throw std::invalid_argument("HyperLogLog precisions differ");
+        }
+        for (size_t i = 0; i < registers.size(); i++)
+        {
+            registers[i] = std::max(registers[i], other.registers[i]);
+        }
+    }
+
+    uint64_t estimate() const
+    {
+        double m = registers.size();
+        double sum = 0;
+        size_t zeros = 0;
+        for (uint8_t rank : registers)
+        {
+            sum += std::ldexp(1.0, -rank);
+            zeros += rank == 0;
+        }
+        double alpha = 0.7213 / (1 + 1.079 / m);
+        double raw = alpha * m * m / sum;
+        // Linear counting is more accurate while many registers are empty
+        if (raw <= 2.5 * m && zeros > 0)
+        {
+            return std::llround(m * std::log(m / zeros));
+        }
+        return std::llround(raw);
+    }
+
+    int get_precision() const
+    {
+        return precision;
+    }
+
+    // Two hex digits per register, for the line-based protocol
+    std::string to_hex() const
+    {
+        static const char digits[] = "0123456789abcdef";
+        std::string hex;
+        hex.reserve(2 * registers.size());
+        for (uint8_t rank : registers)
+        {
+            hex += digits[rank >> 4];
+            hex += digits[rank & 15];
+        }
+        return hex;
+    }
+
+    // False when hex does not hold 2^precision registers
+    bool from_hex(int hex_precision, std::string_view hex)
+    {
+        if (hex_precision < 4 || hex_precision > 18 || hex.size() != 2 * (size_t(1) << hex_precision))
+        {
+            return false;
+        }
+        std::vector<uint8_t> parsed(size_t(1) << hex_precision);
+        for (size_t i = 0; i < parsed.size(); i++)
+        {
+            int high = hex_digit(hex[2 * i]), low = hex_digit(hex[2 * i + 1]);
+            if (high < 0 || low < 0)
+            {
+                return false;
+            }
+            parsed[i] = high << 4 | low;
+        }
+        precision = hex_precision;
+        registers.swap(parsed);
+        return true;
+    }
+
+private:
+    static int hex_digit(char c)
+    {
+        if (c >= '0' && c <= '9')
+        {
+            return c - '0';
+        }
+        if (c >= 'a' && c <= 'f')
+        {
+            return c - 'a' + 10;
+        }
+        return -1;
+    }
+};
+
+// "word, count, error" lines, most frequent first
+inline void write_top_k_text(std::ostream &out, const std::vector<SpaceSaving::Counter> &counters)
+{
+    for (const auto &counter : counters)
+    {
+        out << counter.word << ", " << counter.count << ", " << counter.error << "\n";
+    }
+}
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef SOCKET_TUNING_HPP
+#define SOCKET_TUNING_HPP
+
+// Named TCP socket profiles, selected with "socket_profile" in the config and
+// adjusted per option with a "socket_options" object, e.g.
+//   "socket_profile": "bulk", "socket_options": {"sndbuf": 1048576}
+//
+//   default      kernel defaults (Nagle on, delayed ACKs, autotuned buffers)
+//   low_latency  no Nagle, immediate ACKs, busy polling, small unsent backlog
+//   bulk         no Nagle, 4 MB buffers, each window corked into full segments
+//
+// The p-word packets are far smaller than a segment, so with the defaults
+// Nagle holds the tail of every window until the client's delayed ACK fires.
+
+#include <string>
+#include <atomic>
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "json.hpp"
+
+struct SocketProfile
+{
+    std::string name = "default";
+    bool nodelay = false;
+    bool quickack = false;     // re-armed after every read, the kernel clears it
+    int sndbuf = 0;            // 0: kernel default
+    int rcvbuf = 0;            // 0: kernel default
+    int busy_poll_us = 0;      // 0: off; above net.core.busy_read needs CAP_NET_ADMIN
+    int notsent_lowat = 0;     // 0: kernel default
+    bool cork_windows = false; // sender only: TCP_CORK around each window
+
+    // Throws std::invalid_argument on an unknown profile or option
+    static SocketProfile from_json(const nlohmann::json &config)
+    {
+        SocketProfile profile;
+        profile.name = config.value("socket_profile", "default");
+        if (profile.name == "low_latency")
+        {
+            profile.nodelay = true;
+            profile.quickack = true;
+            profile.busy_poll_us = 50;
+            profile.notsent_lowat = 16384;
+        }
+        else if (profile.name == "bulk")
+        {
+            profile.nodelay = true;
+            profile.sndbuf = 4 << 20;
+            profile.rcvbuf = 4 << 20;
+            profile.cork_windows = true;
+        }
+        else if (profile.name != "default")
+        {
+            throw std::invalid_argument("socket_profile must be 'default', 'low_latency' or 'bulk'");
+        }
+
+        if (config.contains("socket_options"))
+        {
+            for (const auto &option : config["socket_options"].items())
+            {
+                const std::string &key = option.key();
+                if (key == "nodelay")
+                {
+                    profile.nodelay = option.value().get<bool>();
+                }
+                else if (key == "quickack")
+                {
+                    profile.quickack = option.value().get<bool>();
+                }
+                else if (key == "sndbuf")
+                {
+                    profile.sndbuf = option.value().get<int>();
+                }
+                else if (key == "rcvbuf")
+                {
+                    profile.rcvbuf = option.value().get<int>();
+                }
+                else if (key == "busy_poll_us")
+                {
+                    profile.busy_poll_us = option.value().get<int>();
+                }
+                else if (key == "notsent_lowat")
+                {
+                    profile.notsent_lowat = option.value().get<int>();
+                }
+                else if (key == "cork_windows")
+                {
+                    profile.cork_windows = option.value().get<bool>();
+                }
+                else
+                {
+                    throw std::invalid_argument("unknown socket option: " + key);
+                }
+            }
+        }
+        return profile;
+    }
+};
+
+// Warns once per option, not once per connection
+inline void socket_option(int fd, int level, int name, int value, const char *label)
+{
+    static std::atomic<int> warned{0};
+    if (setsockopt(fd, level, name, &value, sizeof(value)) < 0)
+    {
+        int bit = 1 << (name & 31);
+        if (!(warned.fetch_or(bit) & bit))
+        {
+            std::cerr << "Failed to set " << label << ": " << strerror(errno) << std::endl;
+        }
+    }
+}
+
+// Buffers have to be sized before connect/listen to affect window scaling;
+// the rest may be applied at any time.
+inline void apply_socket_profile(int fd, const SocketProfile &profile)
+{
+    if (profile.sndbuf > 0)
+    {
+        socket_option(fd, SOL_SOCKET, SO_SNDBUF, profile.sndbuf, "SO_SNDBUF");
+    }
+    if (profile.rcvbuf > 0)
+    {
+        socket_option(fd, SOL_SOCKET, SO_RCVBUF, profile.rcvbuf, "SO_RCVBUF");
+    }
+    if (profile.nodelay)
+    {
+        socket_option(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+    }
+    if (profile.quickack)
+    {
+        socket_option(fd, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK");
+    }
+    if (profile.busy_poll_us > 0)
+    {
+        socket_option(fd, SOL_SOCKET, SO_BUSY_POLL, profile.busy_poll_us, "SO_BUSY_POLL");
+    }
+    if (profile.notsent_lowat > 0)
+    {
+        socket_option(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, profile.notsent_lowat, "TCP_NOTSENT_LOWAT");
+    }
+}
+
+inline void rearm_quickack(int fd, const SocketProfile &profile)
+{
+    if (profile.quickack)
+    {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+    }
+}
+
+// Holds partial segments while a window is written, flushes on destruction
+class WindowCork
+{
+private:
+    int fd;
+    bool corked;
+
+public:
+    WindowCork(int fd, const SocketProfile &profile) : fd(fd), corked(profile.cork_windows)
+    {
+        if (corked)
+        {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_CORK, &one, sizeof(one));
+        }
+    }
+
+    ~WindowCork()
+    {
+        if (corked)
+        {
+            int zero = 0;
+            setsockopt(fd, IPPROTO_TCP, TCP_CORK, &zero, sizeof(zero));
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,343 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <chrono>
+#include <sys/resource.h>
+#include <unistd.h>
+
+// Log-linear latency histogram in nanoseconds, in the style of HdrHistogram:
+// 128 linear sub-buckets per power of two keep every recorded value within
+// 1% of its bucket. Only the owning thread records; readers merge.
+class LatencyHistogram
+{
+public:
+    static constexpr int SUB_BITS = 7;
+    static constexpr int SUB_COUNT = 1 << SUB_BITS;
+    static constexpr int MAX_EXPONENT = 40; // ~18 minutes
+    static constexpr int BUCKETS = (MAX_EXPONENT - SUB_BITS + 1) * SUB_COUNT;
+
+private:
+    std::atomic<uint64_t> counts[BUCKETS];
+
+    static void bump(std::atomic<uint64_t> &counter, uint64_t amount = 1)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+public:
+    LatencyHistogram()
+    {
+        for (auto &count : counts)
+        {
+            count.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    static int index_of(uint64_t value)
+    {
+        if (value >= (uint64_t(1) << MAX_EXPONENT))
+        {
+            value = (uint64_t(1) << MAX_EXPONENT) - 1;
+        }
+        if (value < SUB_COUNT)
+        {
+            return (int)value;
+        }
+        int exponent = 63 - __builtin_clzll(value);
+        int shift = exponent - SUB_BITS;
+        return ((shift + 1) << SUB_BITS) + (int)((value >> shift) - SUB_COUNT);
+    }
+
+    // Midpoint of the bucket
+    static uint64_t value_at(int index)
+    {
+        if (index < SUB_COUNT)
+        {
+            return index;
+        }
+        int shift = (index >> SUB_BITS) - 1;
+        uint64_t low = (uint64_t)(SUB_COUNT + (index & (SUB_COUNT - 1))) << shift;
+        return low + ((uint64_t(1) << shift) >> 1);
+    }
+
+    void record(uint64_t nanoseconds)
+    {
+        bump(counts[index_of(nanoseconds)]);
+    }
+
+    void merge_into(std::vector<uint64_t> &totals) const
+    {
+        totals.resize(BUCKETS, 0);
+        for (int i = 0; i < BUCKETS; i++)
+        {
+            totals[i] += counts[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    static uint64_t percentile(const std::vector<uint64_t> &totals, double quantile)
+    {
+        uint64_t total = 0;
+        for (uint64_t count : totals)
+        {
+            total += count;
+        }
+        if (total == 0)
+        {
+            return 0;
+        }
+        uint64_t rank = (uint64_t)(quantile * total);
+        if (rank >= total)
+        {
+            rank = total - 1;
+        }
+        uint64_t seen = 0;
+        for (size_t i = 0; i < totals.size(); i++)
+        {
+            seen += totals[i];
+            if (seen > rank)
+            {
+                return value_at(i);
+            }
+        }
+        return value_at(totals.size() - 1);
+    }
+};
+
+enum StatsCommand
+{
+    COMMAND_OFFSET,
+    COMMAND_GET,
+    COMMAND_SHM,
+    COMMAND_NACK,
+    COMMAND_NEXT,
+    COMMAND_SESSION, // SESSION and RESUME
+    COMMAND_DISTINCT,
+    COMMAND_RANGES,
+    COMMAND_INVALID, // answered with "ERR"
+    COMMAND_COUNT
+};
+
+inline const char *stats_command_name(int command)
+{
+    static const char *names[COMMAND_COUNT] = {"offset", "get", "shm", "nack", "next", "session", "distinct", "ranges",
+                                               "invalid"};
+    return names[command];
+}
+
+// Counters owned by one thread. The owner updates them without atomic
+// read-modify-writes; scrapes read them concurrently and merge all threads.
+struct ThreadStats
+{
+    std::atomic<uint64_t> requests[COMMAND_COUNT] = {};
+    std::atomic<uint64_t> bytes_sent{0};
+    std::atomic<uint64_t> words_sent{0};
+    std::atomic<uint64_t> connections_opened{0};
+    std::atomic<uint64_t> connections_closed{0};
+    LatencyHistogram request_latency[COMMAND_COUNT];
+    LatencyHistogram queue_wait;
+
+    // Words per client IP, added once per connection when it closes (per
+    // UDP request), so the send path never takes the lock
+    std::mutex clients_mutex;
+    std::map<std::string, uint64_t> words_per_client;
+
+    static void add(std::atomic<uint64_t> &counter, uint64_t amount = 1)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    void served(uint64_t words, uint64_t bytes)
+    {
+        add(words_sent, words);
+        add(bytes_sent, bytes);
+    }
+
+    void client_served(const std::string &ip, uint64_t words)
+    {
+        std::lock_guard<std::mutex> lock(clients_mutex);
+        words_per_client[ip] += words;
+    }
+};
+
+class StatsRegistry
+{
+private:
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadStats>> threads;
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point last_scrape = started;
+    uint64_t last_requests = 0;
+    uint64_t last_bytes = 0;
+
+public:
+    static StatsRegistry &instance()
+    {
+        static StatsRegistry registry;
+        return registry;
+    }
+
+    ThreadStats *register_thread()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        threads.push_back(std::make_unique<ThreadStats>());
+        return threads.back().get();
+    }
+
+    // OpenMetrics text exposition of every thread's counters merged
+    std::string render()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        uint64_t requests[COMMAND_COUNT] = {};
+        uint64_t bytes = 0, words = 0, opened = 0, closed = 0;
+        std::vector<uint64_t> latency[COMMAND_COUNT];
+        std::vector<uint64_t> queue_wait;
+        std::map<std::string, uint64_t> per_client;
+
+        for (const auto &thread : threads)
+        {
+            for (int c = 0; c < COMMAND_COUNT; c++)
+            {
+                requests[c] += thread->requests[c].load(std::memory_order_relaxed);
+                thread->request_latency[c].merge_into(latency[c]);
+            }
+            bytes += thread->bytes_sent.load(std::memory_order_relaxed);
+            words += thread->words_sent.load(std::memory_order_relaxed);
+            opened += thread->connections_opened.load(std::memory_order_relaxed);
+            closed += thread->connections_closed.load(std::memory_order_relaxed);
+            thread->queue_wait.merge_into(queue_wait);
+
+            std::lock_guard<std::mutex> clients_lock(thread->clients_mutex);
+            for (const auto &entry : thread->words_per_client)
+            {
+                per_client[entry.first] += entry.second;
+            }
+        }
+
+        uint64_t total_requests = 0;
+        for (uint64_t count : requests)
+        {
+            total_requests += count;
+        }
+        auto now = std::chrono::steady_clock::now();
+        double interval = std::chrono::duration<double>(now - last_scrape).count();
+        double request_rate = interval > 0 ? (total_requests - last_requests) / interval : 0;
+        double byte_rate = interval > 0 ? (bytes - last_bytes) / interval : 0;
+        last_scrape = now;
+        last_requests = total_requests;
+        last_bytes = bytes;
+
+        std::string out;
+        char line[256];
+        auto emit = [&](const char *format, auto... args)
+        {
+            snprintf(line, sizeof(line), format, args...);
+            out += line;
+        };
+
+        out += "# TYPE wordserver_requests counter\n";
+        for (int c = 0; c < COMMAND_COUNT; c++)
+        {
+            emit("wordserver_requests_total{command=\"%s\"} %llu\n", stats_command_name(c), (unsigned long long)requests[c]);
+        }
+        out += "# TYPE wordserver_sent_bytes counter\n";
+        emit("wordserver_sent_bytes_total %llu\n", (unsigned long long)bytes);
+        out += "# TYPE wordserver_sent_words counter\n";
+        emit("wordserver_sent_words_total %llu\n", (unsigned long long)words);
+        out += "# HELP wordserver_request_rate Requests per second since the previous scrape.\n";
+        out += "# TYPE wordserver_request_rate gauge\n";
+        emit("wordserver_request_rate %.3f\n", request_rate);
+        out += "# HELP wordserver_byte_rate Bytes sent per second since the previous scrape.\n";
+        out += "# TYPE wordserver_byte_rate gauge\n";
+        emit("wordserver_byte_rate %.3f\n", byte_rate);
+        out += "# TYPE wordserver_active_connections gauge\n";
+        emit("wordserver_active_connections %llu\n", (unsigned long long)(opened - closed));
+
+        out += "# HELP wordserver_request_latency_seconds Time from a parsed request to its last send.\n";
+        out += "# TYPE wordserver_request_latency_seconds summary\n";
+        for (int c = 0; c < COMMAND_COUNT; c++)
+        {
+            uint64_t count = 0;
+            for (uint64_t n : latency[c])
+            {
+                count += n;
+            }
+            if (count == 0)
+            {
+                continue;
+            }
+            for (double q : {0.5, 0.99, 0.999})
+            {
+                emit("wordserver_request_latency_seconds{command=\"%s\",quantile=\"%g\"} %.9f\n", stats_command_name(c), q,
+                     LatencyHistogram::percentile(latency[c], q) / 1e9);
+            }
+            emit("wordserver_request_latency_seconds_count{command=\"%s\"} %llu\n", stats_command_name(c),
+                 (unsigned long long)count);
+        }
+
+        out += "# HELP wordserver_queue_wait_seconds Time a request spent in the scheduler queue.\n";
+        out += "# TYPE wordserver_queue_wait_seconds summary\n";
+        for (double q : {0.5, 0.99, 0.999})
+        {
+            emit("wordserver_queue_wait_seconds{quantile=\"%g\"} %.9f\n", q, LatencyHistogram::percentile(queue_wait, q) / 1e9);
+        }
+
+        out += "# TYPE wordserver_client_sent_words counter\n";
+        for (const auto &entry : per_client)
+        {
+            emit("wordserver_client_sent_words_total{client=\"%s\"} %llu\n", entry.first.c_str(),
+                 (unsigned long long)entry.second);
+        }
+
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        out += "# TYPE process_cpu_seconds counter\n";
+        emit("process_cpu_seconds_total{mode=\"user\"} %.6f\n", usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6);
+        emit("process_cpu_seconds_total{mode=\"system\"} %.6f\n", usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6);
+        out += "# TYPE process_resident_memory_bytes gauge\n";
+        emit("process_resident_memory_bytes %llu\n", (unsigned long long)resident_bytes());
+        out += "# TYPE process_max_resident_memory_bytes gauge\n";
+        emit("process_max_resident_memory_bytes %llu\n", (unsigned long long)usage.ru_maxrss * 1024);
+        out += "# TYPE process_uptime_seconds gauge\n";
+        emit("process_uptime_seconds %.3f\n", std::chrono::duration<double>(now - started).count());
+        out += "# EOF\n";
+        return out;
+    }
+
+    static uint64_t resident_bytes()
+    {
+        unsigned long long size = 0, resident = 0;
+        FILE *statm = fopen("/proc/self/statm", "r");
+        if (statm == nullptr)
+        {
+            return 0;
+        }
+        if (fscanf(statm, "%llu %llu", &size, &resident) != 2)
+        {
+            resident = 0;
+        }
+        fclose(statm);
+        return resident * sysconf(_SC_PAGESIZE);
+    }
+};
+
+inline ThreadStats &thread_stats()
+{
+    thread_local ThreadStats *stats = StatsRegistry::instance().register_thread();
+    return *stats;
+}
+
+inline uint64_t elapsed_ns(std::chrono::steady_clock::time_point since)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - since).count();
+}
+
+#endif
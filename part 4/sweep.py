@@ -0,0 +1,180 @@
+import argparse
+import csv
+import json
+import math
+import os
+import signal
+import subprocess
+import time
+
+import matplotlib.pyplot as plt
+import numpy as np
+
+# Sweeps k, p, client receive buffer and client count with ./loadgen against
+# one ./server. k and p are changed through the server's live config reload
+# (SIGHUP), so the server and its loaded corpus stay up for the whole sweep.
+#
+#   python3 sweep.py --k 10,100,1000 --p 1,10,100 --rcvbuf 0,262144 \
+#       --clients 1,8,32 --reps 5
+#
+# Writes sweep_results.csv (one row per cell, mean and 95% confidence
+# interval of each metric) and sweep_<metric>.png heatmaps of k x p, one
+# panel per (rcvbuf, clients) pair.
+
+CONFIG_FILE = "config_4.json"
+METRICS = {
+    "completion": ("Average completion time (s)", lambda r: r["completion_seconds"]["mean"]),
+    "goodput": ("Words per second", lambda r: r["throughput"]["words_per_second"]),
+    "p99_window": ("p99 window latency (s)", lambda r: r["window_latency_seconds"]["p99"]),
+}
+
+# Two-sided 95% Student t quantiles for 1..30 degrees of freedom
+T_95 = [12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042]
+
+
+def int_list(text):
+    return [int(value) for value in text.split(",")]
+
+
+def confidence_interval(samples):
+    n = len(samples)
+    mean = float(np.mean(samples))
+    if n < 2:
+        return mean, 0.0
+    t = T_95[n - 2] if n - 1 <= len(T_95) else 1.96
+    return mean, t * float(np.std(samples, ddof=1)) / math.sqrt(n)
+
+
+def apply_config(server, base_config, k, p):
+    config = dict(base_config, k=k, p=p)
+    with open(CONFIG_FILE, "w") as f:
+        json.dump(config, f, indent=4)
+    server.send_signal(signal.SIGHUP)
+    time.sleep(0.6)  # the reload thread polls every 250 ms
+
+
+def run_loadgen(args, clients, rcvbuf, rep):
+    command = [
+        "./loadgen", "--clients", str(clients), "--threads", str(args.threads),
+        "--arrival", args.arrival, "--rate", str(args.rate), "--windows", str(args.windows),
+        "--rcvbuf", str(rcvbuf), "--seed", str(rep + 1), "--timeout", str(args.timeout),
+        "--json", "sweep_run.json", "--csv", os.devnull,
+    ]
+    result = subprocess.run(command, capture_output=True, text=True)
+    if result.returncode != 0:
+        print(f"WARNING: loadgen exited with {result.returncode}: {result.stdout.splitlines()[-3:]}")
+        return None
+    with open("sweep_run.json") as f:
+        return json.load(f)
+
+
+def run_sweep(args):
+    with open(CONFIG_FILE) as f:
+        base_config = json.load(f)
+
+    server = subprocess.Popen(["./server", args.policy], stdout=subprocess.DEVNULL)
+    time.sleep(1)  # Give the server time to start and load the corpus
+    rows = []
+    try:
+        for k in args.k:
+            for p in args.p:
+                if p > k:
+                    continue
+                apply_config(server, base_config, k, p)
+                for rcvbuf in args.rcvbuf:
+                    for clients in args.clients:
+                        samples = {metric: [] for metric in METRICS}
+                        for rep in range(args.reps):
+                            report = run_loadgen(args, clients, rcvbuf, rep)
+                            if report is None:
+                                continue
+                            for metric, (_, extract) in METRICS.items():
+                                samples[metric].append(extract(report))
+
+                        row = {"k": k, "p": p, "rcvbuf": rcvbuf, "clients": clients,
+                               "reps": len(samples["completion"])}
+                        for metric, values in samples.items():
+                            mean, half_width = confidence_interval(values) if values else (float("nan"), 0.0)
+                            row[metric] = mean
+                            row[metric + "_ci95"] = half_width
+                        rows.append(row)
+                        print(f"k={k} p={p} rcvbuf={rcvbuf} clients={clients}: "
+                              f"completion {row['completion']:.4f} +/- {row['completion_ci95']:.4f} s, "
+                              f"goodput {row['goodput']:.0f} words/s")
+    finally:
+        server.terminate()
+        server.wait()
+        with open(CONFIG_FILE, "w") as f:
+            json.dump(base_config, f, indent=4)
+        if os.path.exists("sweep_run.json"):
+            os.remove("sweep_run.json")
+    return rows
+
+
+def write_results(rows, filename):
+    if not rows:
+        return
+    with open(filename, "w", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=list(rows[0].keys()))
+        writer.writeheader()
+        writer.writerows(rows)
+    print(f"Results written to {filename}")
+
+
+def plot_heatmaps(rows, args):
+    panels = [(rcvbuf, clients) for rcvbuf in args.rcvbuf for clients in args.clients]
+    for metric, (label, _) in METRICS.items():
+        columns = min(len(panels), 3)
+        lines = math.ceil(len(panels) / columns)
+        fig, axes = plt.subplots(lines, columns, figsize=(5 * columns, 4 * lines), squeeze=False)
+        for index, (rcvbuf, clients) in enumerate(panels):
+            ax = axes[index // columns][index % columns]
+            grid = np.full((len(args.k), len(args.p)), np.nan)
+            for row in rows:
+                if row["rcvbuf"] == rcvbuf and row["clients"] == clients:
+                    grid[args.k.index(row["k"])][args.p.index(row["p"])] = row[metric]
+            image = ax.imshow(grid, origin="lower", aspect="auto", cmap="viridis")
+            for i in range(len(args.k)):
+                for j in range(len(args.p)):
+                    if not np.isnan(grid[i][j]):
+                        ax.text(j, i, f"{grid[i][j]:.3g}", ha="center", va="center", color="w", fontsize=8)
+            ax.set_xticks(range(len(args.p)), [str(p) for p in args.p])
+            ax.set_yticks(range(len(args.k)), [str(k) for k in args.k])
+            ax.set_xlabel("p")
+            ax.set_ylabel("k")
+            ax.set_title(f"rcvbuf={rcvbuf or 'default'}, clients={clients}")
+            fig.colorbar(image, ax=ax, label=label)
+        for index in range(len(panels), lines * columns):
+            axes[index // columns][index % columns].axis("off")
+        fig.suptitle(label)
+        fig.tight_layout()
+        fig.savefig(f"sweep_{metric}.png")
+        plt.close(fig)
+        print(f"Heatmap saved as sweep_{metric}.png")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Sweep k, p, rcvbuf and client count with ./loadgen")
+    parser.add_argument("--k", type=int_list, default=[10, 100, 1000])
+    parser.add_argument("--p", type=int_list, default=[1, 10, 100])
+    parser.add_argument("--rcvbuf", type=int_list, default=[0])
+    parser.add_argument("--clients", type=int_list, default=[1, 8, 32])
+    parser.add_argument("--reps", type=int, default=5)
+    parser.add_argument("--policy", default="fifo")
+    parser.add_argument("--arrival", default="closed")
+    parser.add_argument("--rate", type=float, default=500)
+    parser.add_argument("--windows", type=int, default=0)
+    parser.add_argument("--threads", type=int, default=4)
+    parser.add_argument("--timeout", type=float, default=120)
+    parser.add_argument("--output", default="sweep_results.csv")
+    args = parser.parse_args()
+
+    rows = run_sweep(args)
+    write_results(rows, args.output)
+    plot_heatmaps(rows, args)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,282 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+// Hot-path event tracing, compiled in with -DWORDCOUNT_TRACE (make TRACE=1).
+// Each thread records into its own ring of the most recent events; nothing
+// is shared on the recording path. The rings are written out as Chrome /
+// Perfetto trace JSON (trace_<process>_<pid>.json) at exit, on SIGUSR1, or
+// on SIGINT/SIGTERM when the program leaves those at their default action.
+// Timestamps come from CLOCK_MONOTONIC, so traces of a client and a server
+// on the same machine line up once merged (see merge_traces.py).
+
+#include <chrono>
+
+#ifdef WORDCOUNT_TRACE
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+// Events kept per recording thread; make TRACE_EVENTS=<n> overrides it.
+// A thread's ring is allocated when it records its first event.
+#ifndef WORDCOUNT_TRACE_EVENTS
+#define WORDCOUNT_TRACE_EVENTS 4096
+#endif
+
+struct TraceEvent
+{
+    const char *name; // string literal
+    uint64_t start_ns;
+    uint64_t duration_ns; // 0 for instant events
+    int64_t arg;
+};
+
+class TraceRing
+{
+public:
+    static constexpr size_t CAPACITY = WORDCOUNT_TRACE_EVENTS;
+    static_assert(CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0, "WORDCOUNT_TRACE_EVENTS must be a power of two");
+
+private:
+    // A seqlock per slot: sequence is 0 while the owner writes the slot and
+    // event number + 1 once it is complete, so a snapshot taken while the
+    // owner records skips torn slots instead of racing on them
+    struct Slot
+    {
+        std::atomic<uint64_t> sequence{0};
+        std::atomic<const char *> name{nullptr};
+        std::atomic<uint64_t> start_ns{0};
+        std::atomic<uint64_t> duration_ns{0};
+        std::atomic<int64_t> arg{0};
+    };
+
+    std::unique_ptr<Slot[]> slots{new Slot[CAPACITY]};
+
+public:
+    std::atomic<uint64_t> head{0};
+    long tid = syscall(SYS_gettid);
+    std::atomic<const char *> thread_name{nullptr};
+
+    void push(const TraceEvent &event)
+    {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        Slot &slot = slots[h & (CAPACITY - 1)];
+        slot.sequence.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.name.store(event.name, std::memory_order_relaxed);
+        slot.start_ns.store(event.start_ns, std::memory_order_relaxed);
+        slot.duration_ns.store(event.duration_ns, std::memory_order_relaxed);
+        slot.arg.store(event.arg, std::memory_order_relaxed);
+        slot.sequence.store(h + 1, std::memory_order_release);
+        head.store(h + 1, std::memory_order_release);
+    }
+
+    // Copies out the most recent events that were complete and not
+    // overwritten while copying
+    void snapshot(std::vector<TraceEvent> &out) const
+    {
+        uint64_t end = head.load(std::memory_order_acquire);
+        uint64_t begin = end > CAPACITY ? end - CAPACITY : 0;
+        for (uint64_t i = begin; i < end; i++)
+        {
+            const Slot &slot = slots[i & (CAPACITY - 1)];
+            if (slot.sequence.load(std::memory_order_acquire) != i + 1)
+            {
+                continue;
+            }
+            TraceEvent event = {slot.name.load(std::memory_order_relaxed), slot.start_ns.load(std::memory_order_relaxed),
+                                slot.duration_ns.load(std::memory_order_relaxed), slot.arg.load(std::memory_order_relaxed)};
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) == i + 1)
+            {
+                out.push_back(event);
+            }
+        }
+    }
+};
+
+class TraceRegistry
+{
+private:
+    std::mutex mutex;
+    std::vector<std::unique_ptr<TraceRing>> rings;
+    std::string process_name = "process";
+
+public:
+    // 1: dump, 2: dump and exit
+    static inline volatile sig_atomic_t dump_requested = 0;
+
+    static TraceRegistry &instance()
+    {
+        static TraceRegistry registry;
+        return registry;
+    }
+
+    TraceRing *register_thread()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        rings.push_back(std::make_unique<TraceRing>());
+        return rings.back().get();
+    }
+
+    void set_process_name(const std::string &name)
+    {
+        process_name = name;
+    }
+
+    void dump()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::string filename = "trace_" + process_name + "_" + std::to_string(getpid()) + ".json";
+        FILE *out = fopen(filename.c_str(), "w");
+        if (out == nullptr)
+        {
+            return;
+        }
+
+        int pid = getpid();
+        fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+        fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}}", pid,
+                process_name.c_str());
+
+        std::vector<TraceEvent> events;
+        for (const auto &ring : rings)
+        {
+            const char *thread_name = ring->thread_name.load(std::memory_order_relaxed);
+            if (thread_name != nullptr)
+            {
+                fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%ld,\"args\":{\"name\":\"%s\"}}",
+                        pid, ring->tid, thread_name);
+            }
+            events.clear();
+            ring->snapshot(events);
+            for (const auto &event : events)
+            {
+                if (event.duration_ns > 0)
+                {
+                    fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%ld,\"args\":{\"v\":%lld}}",
+                            event.name, event.start_ns / 1e3, event.duration_ns / 1e3, pid, ring->tid, (long long)event.arg);
+                }
+                else
+                {
+                    fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%d,\"tid\":%ld,\"args\":{\"v\":%lld}}",
+                            event.name, event.start_ns / 1e3, pid, ring->tid, (long long)event.arg);
+                }
+            }
+        }
+        fprintf(out, "\n]}\n");
+        fclose(out);
+        std::cerr << "Trace written to " << filename << std::endl;
+    }
+};
+
+inline uint64_t trace_now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline TraceRing &trace_ring()
+{
+    thread_local TraceRing *ring = TraceRegistry::instance().register_thread();
+    return *ring;
+}
+
+inline void trace_complete(const char *name, uint64_t start_ns, int64_t arg = 0)
+{
+    uint64_t now = trace_now_ns();
+    trace_ring().push({name, start_ns, now > start_ns ? now - start_ns : 1, arg});
+}
+
+class TraceScope
+{
+private:
+    const char *name;
+    uint64_t start_ns;
+    int64_t arg;
+
+public:
+    TraceScope(const char *name, int64_t arg = 0) : name(name), start_ns(trace_now_ns()), arg(arg) {}
+
+    ~TraceScope()
+    {
+        trace_complete(name, start_ns, arg);
+    }
+};
+
+inline void trace_start(const char *process_name)
+{
+    TraceRegistry::instance().set_process_name(process_name);
+    atexit([]
+           { TraceRegistry::instance().dump(); });
+
+    struct sigaction sa;
+    sa.sa_handler = [](int signal)
+    { TraceRegistry::dump_requested = signal == SIGUSR1 ? 1 : 2; };
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, NULL);
+    for (int signal : {SIGINT, SIGTERM})
+    {
+        struct sigaction previous;
+        if (sigaction(signal, NULL, &previous) == 0 && previous.sa_handler == SIG_DFL)
+        {
+            sigaction(signal, &sa, NULL);
+        }
+    }
+
+    // File I/O is not signal safe, so the handler only raises a flag
+    std::thread([]
+                {
+        while (true)
+        {
+            usleep(100000);
+            int request = TraceRegistry::dump_requested;
+            if (request != 0)
+            {
+                TraceRegistry::dump_requested = 0;
+                TraceRegistry::instance().dump();
+                if (request == 2)
+                {
+                    _exit(0);
+                }
+            }
+        } })
+        .detach();
+}
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_START(process_name) trace_start(process_name)
+#define TRACE_THREAD_NAME(name) (trace_ring().thread_name = (name))
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_SCOPE_ARG(name, arg) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name, arg)
+#define TRACE_INSTANT(name, arg) trace_ring().push({name, trace_now_ns(), 0, (int64_t)(arg)})
+#define TRACE_SINCE(name, steady_time_point, arg)                                                          \
+    trace_complete(name,                                                                                    \
+                   std::chrono::duration_cast<std::chrono::nanoseconds>((steady_time_point).time_since_epoch()) \
+                       .count(),                                                                            \
+                   arg)
+
+#else
+
+#define TRACE_START(process_name) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_SCOPE_ARG(name, arg) ((void)0)
+#define TRACE_INSTANT(name, arg) ((void)0)
+#define TRACE_SINCE(name, steady_time_point, arg) ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,166 @@
+#ifndef UDP_PROTOCOL_HPP
+#define UDP_PROTOCOL_HPP
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <arpa/inet.h>
+
+// Datagram mode wire format.
+//   client -> server: "NACK <offset>:<count> <offset>:<count> ...\n"
+//                     (the first request for a window is a NACK of all of it)
+//   server -> client: UdpDatagramHeader followed by <count> comma separated words
+// Every data datagram names its own offset, so the client can place it no
+// matter in which order datagrams arrive and re-request only the holes.
+//
+// The server answers unauthenticated datagrams, so what one NACK can cost is
+// bounded: at most UDP_MAX_NACK_RANGES ranges, each clamped to max_window
+// words, and at most udp_max_words words in all. A word that does not fit in
+// one datagram is never sent; the server answers UDP_FLAG_WORD_TOO_LONG at
+// its offset instead, and the client falls back to TCP.
+constexpr size_t UDP_MAX_DATAGRAM = 1472;
+constexpr size_t UDP_MAX_PAYLOAD = 1400;
+constexpr size_t UDP_MAX_NACK_RANGES = 64;
+constexpr uint16_t UDP_FLAG_WORD_TOO_LONG = 1;
+
+typedef std::pair<uint32_t, uint32_t> WordRange; // <offset, count>
+
+struct UdpDatagramHeader
+{
+    uint32_t offset;
+    uint32_t total;
+    uint16_t count;
+    uint16_t flags;
+};
+
+inline void encode_udp_header(char *buffer, uint32_t offset, uint16_t count, uint32_t total, uint16_t flags = 0)
+{
+    UdpDatagramHeader header;
+    header.offset = htonl(offset);
+    header.total = htonl(total);
+    header.count = htons(count);
+    header.flags = htons(flags);
+    memcpy(buffer, &header, sizeof(header));
+}
+
+inline bool decode_udp_header(const char *buffer, size_t length, UdpDatagramHeader &header)
+{
+    if (length < sizeof(UdpDatagramHeader))
+    {
+        return false;
+    }
+    memcpy(&header, buffer, sizeof(header));
+    header.offset = ntohl(header.offset);
+    header.total = ntohl(header.total);
+    header.count = ntohs(header.count);
+    header.flags = ntohs(header.flags);
+    return true;
+}
+
+// Splits the ranges over as many NACK datagrams as needed.
+inline std::vector<std::string> encode_nacks(const std::vector<WordRange> &ranges)
+{
+    std::vector<std::string> messages;
+    std::string message = "NACK";
+    size_t in_message = 0;
+    char item[32];
+    for (const auto &range : ranges)
+    {
+        int length = snprintf(item, sizeof(item), " %u:%u", range.first, range.second);
+        if (message.size() + length + 1 > UDP_MAX_PAYLOAD || in_message == UDP_MAX_NACK_RANGES)
+        {
+            messages.push_back(message + "\n");
+            message = "NACK";
+            in_message = 0;
+        }
+        message.append(item, length);
+        in_message++;
+    }
+    messages.push_back(message + "\n");
+    return messages;
+}
+
+inline std::vector<WordRange> parse_nack(const char *buffer, size_t length)
+{
+    std::vector<WordRange> ranges;
+    std::string message(buffer, length);
+    if (message.compare(0, 4, "NACK") != 0)
+    {
+        return ranges;
+    }
+    const char *cursor = message.c_str() + 4;
+    unsigned int offset, count;
+    int consumed;
+    while (ranges.size() < UDP_MAX_NACK_RANGES && sscanf(cursor, " %u:%u%n", &offset, &count, &consumed) == 2)
+    {
+        ranges.push_back({offset, count});
+        cursor += consumed;
+    }
+    return ranges;
+}
+
+// One bit per word of the corpus, set when that word has been received.
+class RangeBitmap
+{
+private:
+    std::vector<uint64_t> bits;
+    size_t num_set = 0;
+
+public:
+    void resize(size_t size)
+    {
+        bits.assign((size + 63) / 64, 0);
+        num_set = 0;
+    }
+
+    bool test(size_t i) const
+    {
+        return (bits[i / 64] >> (i % 64)) & 1;
+    }
+
+    // Returns true if the bit was not set before
+    bool set(size_t i)
+    {
+        uint64_t mask = uint64_t(1) << (i % 64);
+        if (bits[i / 64] & mask)
+        {
+            return false;
+        }
+        bits[i / 64] |= mask;
+        num_set++;
+        return true;
+    }
+
+    size_t count() const
+    {
+        return num_set;
+    }
+
+    std::vector<WordRange> missing(uint32_t begin, uint32_t end) const
+    {
+        std::vector<WordRange> ranges;
+        uint32_t i = begin;
+        while (i < end)
+        {
+            while (i < end && test(i))
+            {
+                i++;
+            }
+            uint32_t start = i;
+            while (i < end && !test(i))
+            {
+                i++;
+            }
+            if (i > start)
+            {
+                ranges.push_back({start, i - start});
+            }
+        }
+        return ranges;
+    }
+};
+
+#endif